@@ -0,0 +1,334 @@
+/*
+ * bench.c
+ *
+ * Pomiar kosztu przerwań i funkcji drivera w cyklach zegara
+ * Firmware demo (main.c) z własną funkcją main: procedury przerwań wyświetlacza i timera 2
+ * wywoływane są bezpośrednio przez wskaźnik jak funkcje (kończą się reti), a czas mierzy
+ * timer1 bez preskalera - wynik jest dokładny w symulatorze (simavr) i na płytce. Do kosztu
+ * przerwań doliczana jest obsługa wektora, której wywołanie funkcji nie zawiera (ISR_CALL_CYCLES).
+ *
+ * avr-gcc -mmcu=atmega328p -Os -DF_CPU=8000000UL bench/bench.c power.c -o bench.elf
+ * simavr -m atmega328p -f 8000000 bench.elf
+ * (16 MHz: F_CPU=16000000UL i -f 16000000; opcje DISPLAY_... jak przy budowie firmware)
+ * bench/run.sh buduje i uruchamia tak warianty opcji dla 8 i 16 MHz i porównuje CSV
+ * ze wzorcami bench/baseline.
+ *
+ * Wyniki przez USART0 (38400 8N1) jako CSV: nazwa,wartość - wiersz na pomiar, na końcu end.
+ * Przerwanie wyświetlacza: min/max/avg z BENCH_FRAMES ramek (max - granica ramki z
+ * przeliczeniem), udział przerwań w czasie procesora w ppm dla nominalnego odświeżania.
+ * Timery programowe dla 4, 16 i 64 timerów: timer_count.N - Timer_count dla każdego
+ * (tick bez wygaśnięcia), przy TIMER_DELTA_QUEUE także timer_tick.N - Timer_tick bez
+ * wygaśnięcia i timer_tick_expire.N - z wygaśnięciem okresowego timera wracającego na koniec
+ * kolejki.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <stdlib.h>
+
+//driver dołączany w całości - parametry skanowania (SCAN_SLOTS, DISPLAY_REFRESH_HZ) są prywatne
+#include "../display.c"
+#define main demo_main
+#include "../main.c"
+#undef main
+
+#define BAUD 38400
+#define BENCH_FRAMES 8
+//reakcja na przerwanie (4), jmp z tablicy wektorów (3) i reti (4) - icall i ret pustej
+//funkcji odejmowane są jako narzut pomiaru
+#define ISR_CALL_CYCLES 11
+
+extern void TIMER0_OVF_vect(void);
+extern void TIMER0_COMPB_vect(void);
+#ifndef DISPLAY_TICK_MS
+extern void TIMER2_OVF_vect(void);
+#endif
+
+static void uart_init(void)
+{
+	UBRR0 = F_CPU / 16 / BAUD - 1;
+	UCSR0B = _BV(TXEN0);
+	UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);
+}
+
+static void uart_putc(char c)
+{
+	while(!(UCSR0A & _BV(UDRE0)));
+	UDR0 = c;
+}
+
+static void uart_puts(const __flash char *s)
+{
+	while(*s) {
+		uart_putc(*s++);
+	}
+}
+
+static void uart_putu(uint32_t value)
+{
+	char buf[11];
+	ultoa(value, buf, 10);
+	for(char *p = buf; *p; p++) {
+		uart_putc(*p);
+	}
+}
+
+static void report(const __flash char *name, uint32_t value)
+{
+	uart_puts(name);
+	uart_putc(',');
+	uart_putu(value);
+	uart_putc('\n');
+}
+
+//nazwa z liczbą instancji: nazwa.n
+static void report_n(const __flash char *name, uint8_t n, uint32_t value)
+{
+	uart_puts(name);
+	uart_putc('.');
+	uart_putu(n);
+	uart_putc(',');
+	uart_putu(value);
+	uart_putc('\n');
+}
+
+#define REPORT(name, value) do { \
+	static const __flash char report_name[] = name; \
+	report(report_name, value); \
+} while(0)
+
+#define REPORT_N(name, n, value) do { \
+	static const __flash char report_name[] = name; \
+	report_n(report_name, n, value); \
+} while(0)
+
+/*
+ * Pomiar wywołania przez wskaźnik - kompilator nie przeniesie kodu poza odczyty TCNT1,
+ * narzut wywołania pustej funkcji odejmowany
+ */
+static uint16_t overhead;
+
+static void __attribute__((noinline)) bench_empty(void)
+{
+}
+
+static uint16_t __attribute__((noinline)) bench_call(void (*fn)(void))
+{
+	uint16_t start = TCNT1;
+	fn();
+	uint16_t cycles = TCNT1 - start;
+	//przerwania wywołane jako funkcje kończą się reti
+	cli();
+	return cycles - overhead;
+}
+
+/*
+ * Setery - argument zmieniany między wywołaniami, żeby nie kończyły się na pamięci stanu
+ */
+static uint8_t arg;
+
+static void b_number(void)
+{
+	display_number(arg);
+}
+
+static void b_number_clear(void)
+{
+	display_number_clear();
+}
+
+static void b_power(void)
+{
+	display_power(arg & 1);
+}
+
+static void b_percent(void)
+{
+	display_percent(arg & 1);
+}
+
+static void b_droplet(void)
+{
+	display_droplet(arg);
+}
+
+static void b_filling(void)
+{
+	display_filling(arg);
+}
+
+static void b_clear(void)
+{
+	display_clear();
+}
+
+static void b_brigthness(void)
+{
+	display_brigthness(arg);
+}
+
+static void b_luminance(void)
+{
+	display_luminance(arg);
+}
+
+static void b_commit(void)
+{
+	display_invalidate();
+	display_begin();
+	display_commit();
+}
+
+/*
+ * Timery programowe - tablica wspólna dla obu pomiarów, timery aplikacji demo nie działają
+ */
+static Timer bench_timers[64];
+static uint8_t timers_n;
+
+static void b_timer_count(void)
+{
+	for(uint8_t i = 0; i < timers_n; i++) {
+		Timer_count(&bench_timers[i]);
+	}
+}
+
+#ifdef TIMER_DELTA_QUEUE
+static void b_timer_tick(void)
+{
+	Timer_tick();
+}
+#endif
+
+static void bench_timers_run(uint8_t n)
+{
+	timers_n = n;
+	//liczniki bez wygaśnięcia w czasie pomiaru
+	for(uint8_t i = 0; i < n; i++) {
+		Timer_ctor(&bench_timers[i]);
+		bench_timers[i].cnt = 2;
+	}
+	REPORT_N("timer_count", n, bench_call(b_timer_count));
+	for(uint8_t i = 0; i < n; i++) {
+		Timer_ctor(&bench_timers[i]);
+	}
+#ifdef TIMER_DELTA_QUEUE
+	//pierwszy wygasa po ticku i wraca z okresem dłuższym niż pozostałe - na koniec kolejki
+	Timer_setPeriodic(&bench_timers[0], 1, n + 2);
+	for(uint8_t i = 1; i < n; i++) {
+		Timer_setPeriodic(&bench_timers[i], i + 2, i + 2);
+	}
+	REPORT_N("timer_tick_expire", n, bench_call(b_timer_tick));
+	REPORT_N("timer_tick", n, bench_call(b_timer_tick));
+	for(uint8_t i = 0; i < n; i++) {
+		Timer_ctor(&bench_timers[i]);
+	}
+#endif
+}
+
+//koszt dwóch wartości argumentu, zwraca większy
+static uint16_t bench_setter(void (*fn)(void), uint8_t a, uint8_t b)
+{
+	arg = a;
+	uint16_t first = bench_call(fn);
+	arg = b;
+	uint16_t second = bench_call(fn);
+	return (first > second) ? first : second;
+}
+
+#pragma GCC diagnostic ignored "-Wmain"
+void main()
+{
+	uart_init();
+	//timer1 - licznik cykli
+	TCCR1A = 0;
+	TCCR1B = _BV(CS10);
+	overhead = 0;
+	overhead = bench_call(bench_empty);
+
+	display_init();
+	//timer0 liczy (ścieżki display_commit jak w pracy), ale jego przerwania nie są zgłaszane
+	TIMSK0 = 0;
+	cli();
+
+	REPORT("f_cpu", F_CPU);
+	REPORT("refresh_hz", DISPLAY_REFRESH_HZ);
+	REPORT("scan_slots", SCAN_SLOTS);
+
+	REPORT("display_number", bench_setter(b_number, 12, 34));
+	arg = 34;
+	REPORT("display_number_same", bench_call(b_number));
+	REPORT("display_number_clear", bench_call(b_number_clear));
+	REPORT("display_power", bench_setter(b_power, 1, 0));
+	REPORT("display_percent", bench_setter(b_percent, 1, 0));
+	REPORT("display_droplet", bench_setter(b_droplet, 3, 4));
+	REPORT("display_filling", bench_setter(b_filling, 2, 3));
+	REPORT("display_clear", bench_call(b_clear));
+	REPORT("display_brigthness", bench_setter(b_brigthness, 50, 80));
+	REPORT("display_luminance", bench_setter(b_luminance, 100, 200));
+	REPORT("display_commit", bench_call(b_commit));
+
+	//pełna treść do pomiaru skanowania
+	display_begin();
+	display_number(88);
+	display_power(true);
+	display_percent(true);
+	display_droplet(5);
+	display_filling(4);
+	display_commit();
+
+	uint32_t slots = 0;
+	uint32_t ovf_sum = 0, compb_sum = 0;
+	uint16_t ovf_min = UINT16_MAX, ovf_max = 0, compb_min = UINT16_MAX, compb_max = 0;
+	for(uint16_t i = 0; i < BENCH_FRAMES * SCAN_SLOTS; i++) {
+		uint16_t c = bench_call(TIMER0_OVF_vect) + ISR_CALL_CYCLES;
+		ovf_sum += c;
+		if(c < ovf_min) {
+			ovf_min = c;
+		}
+		if(c > ovf_max) {
+			ovf_max = c;
+		}
+		c = bench_call(TIMER0_COMPB_vect) + ISR_CALL_CYCLES;
+		compb_sum += c;
+		if(c < compb_min) {
+			compb_min = c;
+		}
+		if(c > compb_max) {
+			compb_max = c;
+		}
+		slots++;
+	}
+	REPORT("TIMER0_OVF_vect.min", ovf_min);
+	REPORT("TIMER0_OVF_vect.max", ovf_max);
+	REPORT("TIMER0_OVF_vect.avg", ovf_sum / slots);
+	REPORT("TIMER0_COMPB_vect.min", compb_min);
+	REPORT("TIMER0_COMPB_vect.max", compb_max);
+	REPORT("TIMER0_COMPB_vect.avg", compb_sum / slots);
+
+	//sloty na sekundę przy nominalnym odświeżaniu
+	uint32_t isr_cycles = (ovf_sum + compb_sum) / slots * ((uint32_t)DISPLAY_REFRESH_HZ * SCAN_SLOTS);
+#ifndef DISPLAY_TICK_MS
+	uint16_t tick = bench_call(TIMER2_OVF_vect) + ISR_CALL_CYCLES;
+	REPORT("TIMER2_OVF_vect", tick);
+	isr_cycles += (uint32_t)tick * (1000 / TICK_MS);
+#endif
+	REPORT("isr_cycles_per_s", isr_cycles);
+	REPORT("isr_share_ppm", (uint64_t)isr_cycles * 1000000 / F_CPU);
+
+	bench_timers_run(4);
+	bench_timers_run(16);
+	bench_timers_run(64);
+	static const __flash char end[] = "end\n";
+	//TXC0 zerowane zapisem jedynki - ustawione znów po wysłaniu ostatniego znaku
+	UCSR0A |= _BV(TXC0);
+	uart_puts(end);
+	while(!(UCSR0A & _BV(TXC0)));
+
+	//sen z wyłączonymi przerwaniami - simavr kończy symulację
+	set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+	sleep_enable();
+	for(;;) {
+		sleep_cpu();
+	}
+}
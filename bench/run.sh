@@ -0,0 +1,70 @@
+#!/bin/sh
+#
+# run.sh
+#
+# Budowa bench.elf dla 8 i 16 MHz i pomiar w simavr
+# Dla każdego wariantu opcji (VARIANTS, -D bez przedrostka) i częstotliwości wynik CSV
+# zapisywany jest do bench/out/<wariant>-<MHz>mhz.csv i porównywany ze wzorcem
+# bench/baseline/<wariant>-<MHz>mhz.csv. -u zapisuje bieżące wyniki jako nowe wzorce.
+# Wymaga avr-gcc, avr-libc i simavr w PATH.
+#
+# bench/run.sh [-u] [wariant ...]
+
+cd "$(dirname "$0")/.." || exit 1
+
+VARIANTS="default DISPLAY_ISR_ASM DISPLAY_BLANK_TOGGLE TIMER_DELTA_QUEUE"
+MCU=atmega328p
+
+update=false
+if [ "$1" = "-u" ]; then
+	update=true
+	shift
+fi
+if [ $# -gt 0 ]; then
+	VARIANTS="$*"
+fi
+
+mkdir -p bench/out bench/baseline || exit 1
+failed=0
+
+for variant in $VARIANTS; do
+	flags=
+	if [ "$variant" != default ]; then
+		flags="-D$variant"
+	fi
+	for mhz in 8 16; do
+		name=$variant-${mhz}mhz
+		elf=bench/out/$name.elf
+		csv=bench/out/$name.csv
+		f_cpu=${mhz}000000
+		if ! avr-gcc -mmcu=$MCU -std=gnu11 -Os -Wall -DF_CPU=${f_cpu}UL $flags \
+				bench/bench.c power.c -o "$elf"; then
+			echo "BUILD $name"
+			failed=1
+			continue
+		fi
+		#bench kończy się snem z wyłączonymi przerwaniami - simavr wtedy kończy pracę;
+		#z wyjścia USART (zależnie od wersji z przedrostkiem i kolorami) tylko wiersze CSV
+		timeout 600 simavr -m $MCU -f $f_cpu "$elf" 2>&1 \
+			| sed 's/\x1b\[[0-9;]*m//g' \
+			| sed -n 's/^\(.*[^A-Za-z0-9_.]\)\{0,1\}\([A-Za-z_][A-Za-z0-9_.]*,[0-9][0-9]*\)[[:space:]]*$/\2/p' \
+			> "$csv"
+		if ! grep -q '^f_cpu,' "$csv"; then
+			echo "RUN $name"
+			failed=1
+			continue
+		fi
+		if $update; then
+			cp "$csv" "bench/baseline/$name.csv"
+			echo "UPDATE $name"
+		elif [ ! -f "bench/baseline/$name.csv" ]; then
+			echo "NEW $name (brak wzorca, -u zapisuje)"
+		elif diff -u "bench/baseline/$name.csv" "$csv"; then
+			echo "OK $name"
+		else
+			echo "DIFF $name"
+			failed=1
+		fi
+	done
+done
+exit $failed
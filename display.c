@@ -6,8 +6,8 @@
  */
 
 #include <avr/interrupt.h>
-#include <avr/pgmspace.h>
-#include <string.h>
+#include <util/atomic.h>
+#include <stddef.h>
 #include "display.h"
 
 //testowanie ISR
@@ -21,6 +21,12 @@
 #define TEST_PIN_1_HIGH	O_PORT |= _BV(TEST_PIN_1);
 #define TEST_PIN_1_LOW	O_PORT &= ~_BV(TEST_PIN_1);
 
+//wersje dla wstawek asemblerowych, wymagają operandu %[port]
+#define TEST_PIN_0_HIGH_ASM	"sbi %[port], " STR(TEST_PIN_0) "\n\t"
+#define TEST_PIN_0_LOW_ASM	"cbi %[port], " STR(TEST_PIN_0) "\n\t"
+#define TEST_PIN_1_HIGH_ASM	"sbi %[port], " STR(TEST_PIN_1) "\n\t"
+#define TEST_PIN_1_LOW_ASM	"cbi %[port], " STR(TEST_PIN_1) "\n\t"
+
 #else
 
 #define TEST_PIN_0_INIT
@@ -31,61 +37,96 @@
 #define TEST_PIN_1_HIGH
 #define TEST_PIN_1_LOW
 
+#define TEST_PIN_0_HIGH_ASM
+#define TEST_PIN_0_LOW_ASM
+#define TEST_PIN_1_HIGH_ASM
+#define TEST_PIN_1_LOW_ASM
+
 #endif
 
+#define STR_(x) #x
+#define STR(x) STR_(x)
+
 #define ARRAY_SIZE(array) (sizeof(array)/sizeof(array[0]))
 /*
  * Maski dla linii wejściowych wyświetlacza
  */
-#define LINE_A _BV(A_PIN)
-#define LINE_B _BV(B_PIN)
-#define LINE_C _BV(C_PIN)
-#define LINE_D _BV(D_PIN)
-#define LINE_E _BV(E_PIN)
-#define LINE_F _BV(F_PIN)
-#define DISPLAY_LINES_MASK (LINE_A|LINE_B|LINE_C|LINE_D|LINE_E|LINE_F)
+#define LINE_MASK(line) _BV(line##_PIN)
+#define LINE_OR(p, line) | LINE_MASK(line)
+#define LINE_COUNT(p, line) + 1
+#define DISPLAY_LINES_MASK (0 DISPLAY_LINES(LINE_OR, 0))
 #define DISPLAY_LINES_NEG_MASK (uint8_t)~DISPLAY_LINES_MASK
+#define LINES_NO (0 DISPLAY_LINES(LINE_COUNT, 0))
+//cbi - pojedyncze bity linii
+#define LINE_PORT_OFF(p, line) O_PORT &= ~LINE_MASK(line);
+#define LINE_DIR_OFF(p, line) O_DIR &= ~LINE_MASK(line);
+_Static_assert(DISPLAY_LINES_MASK <= 0xff, "linie wyświetlacza poza portem O_PORT");
+_Static_assert(__builtin_popcount(DISPLAY_LINES_MASK) == LINES_NO, "linie wyświetlacza na tym samym pinie");
+_Static_assert(LINES_NO >= 2, "za mało linii wyświetlacza");
 
 /*
- * Opis segmentów wyświetlacza
- */
-//makro initializer dla typu segment_type
-//dla aktywnego segmentu parametry określają które piny mają być ustawione w push-pull
-//anode HIGH, cathode LOW
-#define SEGMENT_DEF(anode,cathode) { LINE_##anode | LINE_##cathode, LINE_##anode }
-//dziesiątki
-#define SEG_1 SEGMENT_DEF(B,D)	//D
-#define SEG_2 SEGMENT_DEF(B,E)	//E
-#define SEG_3 SEGMENT_DEF(C,E)	//F
-#define SEG_4 SEGMENT_DEF(C,B)	//A
-#define SEG_5 SEGMENT_DEF(B,C)	//B
-#define SEG_6 SEGMENT_DEF(C,D)	//C
-#define SEG_7 SEGMENT_DEF(D,E)	//G
-//jednostki
-#define SEG_8 SEGMENT_DEF(A,C)	//D
-#define SEG_9 SEGMENT_DEF(D,A)	//E
-#define SEG_10 SEGMENT_DEF(A,D)	//F
-#define SEG_11 SEGMENT_DEF(B,A)	//A
-#define SEG_12 SEGMENT_DEF(A,B)	//B
-#define SEG_13 SEGMENT_DEF(C,A)	//C
-#define SEG_14 SEGMENT_DEF(A,E)	//F
-//znak %
-#define SEG_15 SEGMENT_DEF(D,B)
-//znak błyskawicy
-#define SEG_16 SEGMENT_DEF(D,C)
-//wypełnienie kropli od góry
-#define SEG_17 SEGMENT_DEF(E,A)	//zielony
-#define SEG_18 SEGMENT_DEF(E,B)	//zielony
-#define SEG_19 SEGMENT_DEF(E,C)	//niebieski
-#define SEG_20 SEGMENT_DEF(E,D)	//czerwony
-//kropla od godziny 4 do godziny 1 zgodnie z ruchem wskazówek zegara
-#define SEG_21 SEGMENT_DEF(F,A)
-#define SEG_22 SEGMENT_DEF(F,B)
-#define SEG_23 SEGMENT_DEF(F,C)
-#define SEG_24 SEGMENT_DEF(F,D)
-#define SEG_25 SEGMENT_DEF(F,E)
-
-#define SEG_MAX 25
+ * Mapa segmentów wyświetlacza
+ * X(p, anoda, katoda, obszar, indeks) - segment świeci przy anodzie HIGH i katodzie LOW,
+ * indeks to bit glifu obszaru (opisy obiektów niżej). Obszary zajmują w pamięci ekranu
+ * kolejne pola (dziesiątki, jedności, procent, błyskawica, wypełnienie kropli, kropla),
+ * segment SEG_n to bit n-1. Z mapy kompilator generuje liczbę segmentów, rozmiary i położenie
+ * obszarów, tablicę pinów segments oraz liczbę slotów trybu anodowego - przerwanie nadal
+ * tylko odczytuje tablicę. Kolejność wpisów jest dowolna.
+ * Zakres: linie na jednym porcie (DISPLAY_LINES) i do 32 segmentów (pamięć ekranu 32-bitowa).
+ * Obszary (AREA_LIST) i ich glify (opisy obiektów) należą do tego wyświetlacza - inny układ
+ * segmentów w tych samych obszarach wymaga tylko zmiany mapy, inne obszary także glifów
+ * i seterów.
+ */
+#define SEGMENT_MAP(X, p) \
+	/* dziesiątki */ \
+	X(p, B, D, TENS, 0)		/* D */ \
+	X(p, B, E, TENS, 1)		/* E */ \
+	X(p, C, E, TENS, 2)		/* F */ \
+	X(p, C, B, TENS, 3)		/* A */ \
+	X(p, B, C, TENS, 4)		/* B */ \
+	X(p, C, D, TENS, 5)		/* C */ \
+	X(p, D, E, TENS, 6)		/* G */ \
+	/* jednostki */ \
+	X(p, A, C, UNITS, 0)	/* D */ \
+	X(p, D, A, UNITS, 1)	/* E */ \
+	X(p, A, D, UNITS, 2)	/* F */ \
+	X(p, B, A, UNITS, 3)	/* A */ \
+	X(p, A, B, UNITS, 4)	/* B */ \
+	X(p, C, A, UNITS, 5)	/* C */ \
+	X(p, A, E, UNITS, 6)	/* G */ \
+	/* znak % */ \
+	X(p, D, B, PERCENT, 0) \
+	/* znak błyskawicy */ \
+	X(p, D, C, POWER, 0) \
+	/* wypełnienie kropli od góry */ \
+	X(p, E, A, FILL, 0)		/* zielony */ \
+	X(p, E, B, FILL, 1)		/* zielony */ \
+	X(p, E, C, FILL, 2)		/* niebieski */ \
+	X(p, E, D, FILL, 3)		/* czerwony */ \
+	/* kropla od godziny 4 do godziny 1 zgodnie z ruchem wskazówek zegara */ \
+	X(p, F, A, DROP, 0) \
+	X(p, F, B, DROP, 1) \
+	X(p, F, C, DROP, 2) \
+	X(p, F, D, DROP, 3) \
+	X(p, F, E, DROP, 4)
+
+#define SEG_COUNT(p, anode, cathode, area, index) + 1
+#define SEG_MAX (0 SEGMENT_MAP(SEG_COUNT, 0))
+_Static_assert(SEG_MAX <= LINES_NO * (LINES_NO - 1), "więcej segmentów niż par linii");
+
+//liczba segmentów o anodzie line
+#define ANODE_IS(line, anode, cathode, area, index) + (anode##_PIN == line##_PIN)
+#define ANODE_SEGS(line) (0 SEGMENT_MAP(ANODE_IS, line))
+//najliczniejsza anoda: suma po k warunków "któraś anoda ma więcej niż k segmentów"
+#define ANODE_GT(k, line) || (ANODE_SEGS(line) > k)
+#define ANODES_GT(k) (0 DISPLAY_LINES(ANODE_GT, k))
+#define ANODE_SEGS_MAX (ANODES_GT(0) + ANODES_GT(1) + ANODES_GT(2) + ANODES_GT(3) \
+	+ ANODES_GT(4) + ANODES_GT(5) + ANODES_GT(6))
+
+//pamięć ekranu - bit na segment
+typedef uint32_t screen_type;
+_Static_assert(SEG_MAX <= 32, "więcej niż 32 segmenty - pamięć ekranu jest 32-bitowa");
+#define SEG_ALL_MASK ((screen_type)-1 >> (8 * sizeof(screen_type) - SEG_MAX))
 
 //największa liczba dziesiętna jaką wyświetlacz moze wyświetlić
 #define MAX_NUMBER 99
@@ -99,32 +140,1282 @@ typedef struct segment_tag {
 } segment_type;
 
 /*
- * Pamięć ekranu
- * Obszary bufora są przypisane na stałe dla danego obiektu wyświetlacza (jedności, dzisiątki,
- * kropla, wypełnienie kropli, błyskawica, procent) ale nie muszą być w określonej kolejności
-  */
+ * Pamięć ekranu
+ * Mapa bitowa zapalonych segmentów, bit n-1 odpowiada SEG_n. Obszary zajmują stałe pola bitowe
+ * w kolejności z opisu mapy segmentów, rozmiar pola to liczba segmentów obszaru w mapie,
+ * glif obszaru to bajt wpisywany w pole przez AREA_SET.
+ */
+#define AREA_LIST(X) X(TENS) X(UNITS) X(PERCENT) X(POWER) X(FILL) X(DROP)
+
+#define AREA_ID_DEF(area) AREA_ID_##area,
+enum area_id_tag {
+	AREA_LIST(AREA_ID_DEF)
+};
+#define AREA_COUNT(id, anode, cathode, area, index) + (AREA_ID_##area == AREA_ID_##id)
+#define AREA_SEGS(id) (0 SEGMENT_MAP(AREA_COUNT, id))
+//pole obszaru zaczyna się za segmentami obszarów wcześniejszych na liście
+#define AREA_BEFORE(id, anode, cathode, area, index) + (AREA_ID_##area < AREA_ID_##id)
+#define AREA_SHIFT(id) (0 SEGMENT_MAP(AREA_BEFORE, id))
+
+//stałe wyliczenia - używane także wewnątrz rozwinięć SEGMENT_MAP
+#define AREA_LAYOUT_DEF(area) area##_SEGS_NO = AREA_SEGS(area), area##_SHIFT = AREA_SHIFT(area),
+enum area_layout_tag {
+	AREA_LIST(AREA_LAYOUT_DEF)
+};
+
+//glify obiektów (niżej) zakładają te rozmiary obszarów
+#define DIGIT_SEGS_NO	7
+_Static_assert(TENS_SEGS_NO == DIGIT_SEGS_NO && UNITS_SEGS_NO == DIGIT_SEGS_NO, "cyfra to nie 7 segmentów");
+_Static_assert(PERCENT_SEGS_NO == 1 && POWER_SEGS_NO == 1, "znak to nie 1 segment");
+_Static_assert(FILL_SEGS_NO == 4 && DROP_SEGS_NO == 5, "nieprawidłowe segmenty kropli");
+_Static_assert(UNITS_SHIFT == TENS_SHIFT + DIGIT_SEGS_NO, "jedności nie leżą za dziesiątkami");
+_Static_assert(DROP_SHIFT + DROP_SEGS_NO == SEG_MAX, "segment spoza obszarów AREA_LIST");
+
+/*
+ * Piny segmentów, indeks == numer bitu segmentu w pamięci ekranu
+ * dla aktywnego segmentu linie anody i katody w push-pull, anoda HIGH, katoda LOW
+ */
+#define SEGMENT_DEF(p, anode, cathode, area, index) \
+	[area##_SHIFT + (index)] = { LINE_MASK(anode) | LINE_MASK(cathode), LINE_MASK(anode) },
+__flash static segment_type const segments[SEG_MAX] = {
+		SEGMENT_MAP(SEGMENT_DEF, 0)
+};
+
+//każdy bit pamięci ekranu dokładnie raz, anoda różna od katody, bez powtórzonych par linii
+#define SEG_BIT(p, anode, cathode, area, index) | ((screen_type)1 << (area##_SHIFT + (index)))
+#define SEG_SHORT(p, anode, cathode, area, index) + (anode##_PIN == cathode##_PIN)
+#define SEG_PAIR(p, anode, cathode, area, index) | (1ULL << (anode##_PIN * 8 + cathode##_PIN))
+_Static_assert((0 SEGMENT_MAP(SEG_BIT, 0)) == SEG_ALL_MASK, "indeks segmentu poza obszarem lub powtórzony");
+_Static_assert((0 SEGMENT_MAP(SEG_SHORT, 0)) == 0, "segment z anodą i katodą na tej samej linii");
+_Static_assert(__builtin_popcountll(0 SEGMENT_MAP(SEG_PAIR, 0)) == SEG_MAX, "powtórzona para linii segmentu");
+
+//dziesiątki i jedności razem
+#define NUMBER_SHIFT	TENS_SHIFT
+#define NUMBER_SEGS_NO	(2 * DIGIT_SEGS_NO)
+
+//pole bitowe obszaru w pamięci ekranu
+#define AREA_MASK(area) ((screen_type)(_BV(area##_SEGS_NO) - 1) << area##_SHIFT)
+//wpisanie glifu do obszaru
+#define AREA_SET(area, glyph) area_set(AREA_MASK(area), (screen_type)(glyph) << area##_SHIFT)
+
+static screen_type display;
+//zmiany czekające na display_commit - bez nich display_commit nic nie przelicza
+static bool frame_dirty = true;
+
+static void area_set(screen_type mask, screen_type bits)
+{
+	screen_type d = (display & ~mask) | bits;
+	if(d != display) {
+		display = d;
+		frame_dirty = true;
+	}
+}
+//pamięć ekranu opublikowana przez display_commit, źródło przeliczeń ramki
+static screen_type shown;
+
+//warstwa animacji (display_animate) - obszary zajęte przez animacje i ich bieżące glify
+static volatile screen_type anim_mask;
+static volatile screen_type anim_bits;
+//miganie (display_blink) - obszary migające i aktualnie wygaszone
+static volatile screen_type blink_mask;
+static volatile screen_type blink_off;
+//zmiany warstw z przerwania - scan_render czyta je bez blokowania przerwań i powtarza odczyt,
+//gdy licznik zmienił się w trakcie
+static volatile uint8_t layers_seq;
+
+/*
+ * Bufor skanowania - zawartość kolejnych slotów czasowych odczytywana przez przerwanie
+ * Podwójnie buforowany: przerwanie czyta ramkę przednią, display_commit przelicza pamięć ekranu
+ * do ramki tylnej, a przerwanie zamienia ramki na granicy ramki (counter == 0).
+ * W trybie segmentowym ramka jest kopią mapy bitowej, a przerwanie pobiera piny segmentu
+ * prosto z tablicy segments. W trybie anodowym oraz przy pomijaniu pustych slotów sloty
+ * są przeliczane do RAM (scan_render).
+ */
+#ifdef DISPLAY_SCAN_ANODE
+
+#ifndef DISPLAY_SLOT_SEGS
+#define DISPLAY_SLOT_SEGS ANODE_SEGS_MAX
+#endif
+#if DISPLAY_SLOT_SEGS < 2 || DISPLAY_SLOT_SEGS > ANODE_SEGS_MAX
+#error "DISPLAY_SLOT_SEGS poza zakresem 2 - ANODE_SEGS_MAX"
+#endif
+
+//liczba slotów przypadających na jedną anodę
+#define ANODE_SLOTS ((ANODE_SEGS_MAX + DISPLAY_SLOT_SEGS - 1) / DISPLAY_SLOT_SEGS)
+#define SCAN_SLOTS (LINES_NO * ANODE_SLOTS)
+
+#else
+
+#define SCAN_SLOTS SEG_MAX
+
+#endif
+
+#ifdef DISPLAY_SKIP_NORMALIZE
+#ifndef DISPLAY_SKIP_BLANK
+#error "DISPLAY_SKIP_NORMALIZE wymaga DISPLAY_SKIP_BLANK"
+#endif
+#endif
+
+#ifdef DISPLAY_SLOT_DWELL
+#if defined(DISPLAY_SCAN_ANODE) || defined(DISPLAY_SKIP_NORMALIZE) || defined(DISPLAY_ISR_ASM)
+#error "DISPLAY_SLOT_DWELL tylko przy skanowaniu segmentami, bez DISPLAY_SKIP_NORMALIZE i DISPLAY_ISR_ASM"
+#endif
+#endif
+
+#if defined(DISPLAY_SCAN_ANODE) || defined(DISPLAY_SKIP_BLANK) || defined(DISPLAY_ISR_ASM) \
+	|| defined(DISPLAY_SLOT_DWELL)
+#define SCAN_RENDERED
+#endif
+
+/*
+ * Płaszczyzny bitowe jasności segmentów (DISPLAY_LEVEL_BITS)
+ * Ramka jest przeliczana osobno dla każdej płaszczyzny, przerwanie wyświetla kolejne
+ * płaszczyzny w kolejnych ramkach z czasem świecenia plane_ocr[p] ~ 2^p.
+ */
+#ifdef DISPLAY_LEVEL_BITS
+#if DISPLAY_LEVEL_BITS < 4 || DISPLAY_LEVEL_BITS > 8
+#error "DISPLAY_LEVEL_BITS poza zakresem 4-8"
+#endif
+#ifdef DISPLAY_SKIP_BLANK
+#error "DISPLAY_LEVEL_BITS nie współpracuje z DISPLAY_SKIP_BLANK"
+#endif
+#define LEVEL_PLANES DISPLAY_LEVEL_BITS
+#define LEVEL_MAX ((1 << LEVEL_PLANES) - 1)
+
+//bit i płaszczyzny p - bit p poziomu jasności segmentu SEG_i+1, domyślnie pełna jasność
+static screen_type planes[LEVEL_PLANES] = { [0 ... LEVEL_PLANES - 1] = SEG_ALL_MASK };
+//OCR0B dla płaszczyzn, odczytywane przez przerwanie na granicy ramki
+static volatile uint8_t plane_ocr[LEVEL_PLANES];
+//płaszczyzna wyświetlana w bieżącej ramce
+static uint8_t scan_plane;
+
+//płaszczyzny opublikowane przez display_commit
+static screen_type shown_planes[LEVEL_PLANES];
+
+#define PLANE_BITS(screen, p) ((screen) & shown_planes[p])
+#else
+#define LEVEL_PLANES 1
+#define PLANE_BITS(screen, p) (screen)
+#define scan_plane 0
+#endif
+
+#ifdef DISPLAY_ISR_ASM
+/*
+ * Slot dla przerwania w asemblerze - gotowe wartości do wpisania bez read-modify-write
+ * dir: cały rejestr O_DIR, linie slotu plus kierunek pozostałych pinów portu z chwili przeliczenia
+ * anode: maska anody wpisywana do rejestru PIN (przełączenie LOW->HIGH, linie są LOW po wygaszeniu)
+ */
+typedef struct scan_slot_tag {
+	uint8_t dir;
+	uint8_t anode;
+	uint8_t last;			//ostatni slot ramki - przerwanie przechodzi do scan_frame_vect
+} scan_slot_type;
+#elif defined(DISPLAY_SLOT_DWELL)
+typedef struct scan_slot_tag {
+	segment_type seg;
+	uint8_t dwell;			//czas slotu w 1/DWELL_ONE slotu nominalnego
+} scan_slot_type;
+#else
+typedef segment_type scan_slot_type;
+#endif
+
+typedef struct frame_tag {
+#ifdef DISPLAY_SKIP_BLANK
+	uint8_t len;			//liczba zapalonych slotów (lista budowana od nowa z ramką), 0 zatrzymuje timer
+	uint16_t time;			//czas ramki, 256 - pełna ramka SCAN_SLOTS slotów
+#endif
+#ifdef DISPLAY_SKIP_NORMALIZE
+	uint8_t top;			//OCR0A dla tej ramki
+	uint16_t scale;			//OCR0B = brightness_fix * scale >> 16
+#endif
+#ifdef SCAN_RENDERED
+	scan_slot_type slot[LEVEL_PLANES][SCAN_SLOTS];
+#else
+	screen_type mask[LEVEL_PLANES];	//kopia pamięci ekranu
+#endif
+} frame_type;
+
+#ifdef DISPLAY_SKIP_BLANK
+#define FRAME_LEN(frame) ((frame)->len)
+#define FRAME_TIME(frame) ((frame)->time)
+#else
+#define FRAME_LEN(frame) SCAN_SLOTS
+#define FRAME_TIME(frame) refresh_time
+#endif
+
+static frame_type frames[2];
+static frame_type * volatile scan_frame = &frames[0];	//ramka czytana przez przerwanie
+static uint8_t scan_counter;		//bieżący slot ramki
+static volatile bool pending;		//ramka tylna gotowa, zamiana na granicy ramki
+//ramka tylna przeliczana przez display_commit albo przerwanie (animacja)
+static volatile bool render_busy;
+//zmiana warstwy animacji lub migania czekająca na przeliczenie ramki
+static volatile bool anim_dirty;
+static uint8_t batch;				//zagnieżdżenie display_begin/display_commit
+
+/*
+ * Częstotliwość odświeżania
+ * Preskaler i TOP timera dobierane przez kompilator z DISPLAY_REFRESH_HZ, SCAN_SLOTS i F_CPU.
+ * Przerwanie wywoływane jest raz na slot, więc obciążenie procesora zależy tylko od
+ * DISPLAY_REFRESH_HZ * SCAN_SLOTS - z preskalerów dających TOP <= 255 wybierany jest
+ * najmniejszy, czyli największa rozdzielczość jasności.
+ * np. 70Hz, 25 slotów: 8MHz -> preskaler 64 TOP 70, 16MHz -> preskaler 64 TOP 141
+ * tryb anodowy 70Hz, 8MHz: 6 slotów -> preskaler 256 TOP 73, 12 slotów -> preskaler 64 TOP 148
+ */
+#ifndef DISPLAY_REFRESH_HZ
+#define DISPLAY_REFRESH_HZ 70
+#endif
+//sloty na sekundę
+#define SLOT_HZ (1UL * DISPLAY_REFRESH_HZ * SCAN_SLOTS)
+//okres slotu w taktach timera (TOP + 1) dla preskalera, zaokrąglony
+#define TIMER_PERIOD(div) ((F_CPU + (div) * SLOT_HZ / 2) / ((div) * SLOT_HZ))
+
+#if TIMER_PERIOD(1) <= 256
+#define PRESKALER_MASK _BV(CS00)
+#define PRESKALER_DIV 1
+#elif TIMER_PERIOD(8) <= 256
+#define PRESKALER_MASK _BV(CS01)
+#define PRESKALER_DIV 8
+#elif TIMER_PERIOD(64) <= 256
+#define PRESKALER_MASK (_BV(CS01) | _BV(CS00))
+#define PRESKALER_DIV 64
+#elif TIMER_PERIOD(256) <= 256
+#define PRESKALER_MASK _BV(CS02)
+#define PRESKALER_DIV 256
+#else
+#define PRESKALER_MASK (_BV(CS02) | _BV(CS00))
+#define PRESKALER_DIV 1024
+#endif
+#define TIMER_MAX (TIMER_PERIOD(PRESKALER_DIV) - 1)
+
+//najmniejsza rozdzielczość jasności
+#define TIMER_MAX_MIN 31
+//czas slotu - przerwanie slotu i wygaszenia z zapasem na program główny
+#define SLOT_CYCLES_MIN 256
+
+_Static_assert(TIMER_PERIOD(1024) <= 256, "DISPLAY_REFRESH_HZ za małe - TOP > 255 nawet przy preskalerze 1024");
+_Static_assert(TIMER_PERIOD(PRESKALER_DIV) > TIMER_MAX_MIN, "DISPLAY_REFRESH_HZ za duże - za mała rozdzielczość jasności");
+_Static_assert(F_CPU / SLOT_HZ >= SLOT_CYCLES_MIN, "DISPLAY_REFRESH_HZ za duże - przerwania nie zmieszczą się w slocie");
+
+//bity preskalera timera0
+#define PRESKALER_BITS (_BV(CS02) | _BV(CS01) | _BV(CS00))
+
+typedef struct {
+	uint16_t div;
+	uint8_t mask;
+} preskaler_type;
+
+static const __flash preskaler_type preskalers[] = {
+	{1, _BV(CS00)},
+	{8, _BV(CS01)},
+	{64, _BV(CS01) | _BV(CS00)},
+	{256, _BV(CS02)},
+	{1024, _BV(CS02) | _BV(CS00)},
+};
+
+//czas slotu nominalnego w jednostkach czasu slotu (DISPLAY_SLOT_DWELL)
+#define DWELL_SHIFT 6
+#define DWELL_ONE (1 << DWELL_SHIFT)
+
+#ifdef DISPLAY_SLOT_DWELL
+/*
+ * Czas slotu segmentu (DISPLAY_SLOT_DWELL)
+ * SEGMENT_DWELL(obszar, indeks) - względny czas świecenia segmentu 1-255, dłuższy dla diod
+ * ciemniejszych; skala dowolna, liczą się proporcje. Kompilator przelicza wagi na czas slotu
+ * w 1/DWELL_ONE slotu nominalnego tak, że suma odpowiada SEG_MAX slotom, a resztę
+ * zaokrąglenia (DWELL_SUM) uwzględnia czas ramki - czasy animacji i ticka się nie zmieniają.
+ * Wypełnienie slotu (jasność) jest dla wszystkich segmentów to samo.
+ * Wagi obszarów DWELL_<obszar>(indeks) można podać opcjami kompilatora, domyślnie równe.
+ */
+#define SEGMENT_DWELL(area, index) DWELL_##area(index)
+#ifndef DWELL_TENS
+#define DWELL_TENS(index)		16
+#endif
+#ifndef DWELL_UNITS
+#define DWELL_UNITS(index)		16
+#endif
+#ifndef DWELL_PERCENT
+#define DWELL_PERCENT(index)	16
+#endif
+#ifndef DWELL_POWER
+#define DWELL_POWER(index)		16
+#endif
+//indeksy 0, 1 - zielone, 2 - niebieski, 3 - czerwony
+#ifndef DWELL_FILL
+#define DWELL_FILL(index)		16
+#endif
+#ifndef DWELL_DROP
+#define DWELL_DROP(index)		16
+#endif
+
+#define DWELL_WEIGHT(p, anode, cathode, area, index) + SEGMENT_DWELL(area, index)
+//stałe wyliczenia - używane wewnątrz rozwinięć SEGMENT_MAP
+enum dwell_weights_tag {
+	DWELL_WEIGHTS = 0 SEGMENT_MAP(DWELL_WEIGHT, 0),
+	DWELL_SEGS = SEG_MAX,
+	DWELL_PERIOD = TIMER_MAX + 1,		//takty slotu nominalnego
+};
+#define DWELL_RATIO(area, index) \
+	(((uint32_t)SEGMENT_DWELL(area, index) * DWELL_SEGS * DWELL_ONE + DWELL_WEIGHTS / 2) / DWELL_WEIGHTS)
+
+#define DWELL_DEF(p, anode, cathode, area, index) [area##_SHIFT + (index)] = DWELL_RATIO(area, index),
+__flash static uint8_t const segment_dwell[SEG_MAX] = {
+		SEGMENT_MAP(DWELL_DEF, 0)
+};
+
+//suma czasów slotów pełnej ramki, DWELL_ONE * SEG_MAX z dokładnością zaokrąglenia
+#define DWELL_ADD(p, anode, cathode, area, index) + DWELL_RATIO(area, index)
+enum dwell_sum_tag {
+	DWELL_SUM = 0 SEGMENT_MAP(DWELL_ADD, 0),
+};
+
+//slot mieści się w 8 bitach timera i w nim przerwanie (nominalne odświeżanie)
+#define DWELL_FITS(p, anode, cathode, area, index) \
+	&& DWELL_RATIO(area, index) >= 1 && DWELL_RATIO(area, index) <= 255 \
+	&& DWELL_RATIO(area, index) * DWELL_PERIOD <= 256UL * DWELL_ONE \
+	&& (uint32_t)DWELL_RATIO(area, index) * DWELL_PERIOD * PRESKALER_DIV >= (uint32_t)SLOT_CYCLES_MIN * DWELL_ONE
+_Static_assert(1 SEGMENT_MAP(DWELL_FITS, 0), "SEGMENT_DWELL - slot dłuższy niż 256 taktów timera lub za krótki");
+
+//czas ramki z czasami slotów
+#define DWELL_TIME(time) ((uint32_t)(time) * DWELL_SUM / (SEG_MAX * DWELL_ONE))
+#else
+#define DWELL_TIME(time) (time)
+#endif
+
+/*
+ * Bieżące odświeżanie (display_set_refresh)
+ * Jasność, czasy zmian jasności i animacji liczone są dla ramki nominalnej DISPLAY_REFRESH_HZ.
+ * Przy innym odświeżaniu OCR0B skalowane jest przez refresh_k, a ramka trwa refresh_time
+ * ramek nominalnych.
+ */
+static uint8_t timer_mask = PRESKALER_MASK;		//preskaler
+static volatile uint16_t timer_div = PRESKALER_DIV;
+static volatile uint8_t timer_top = TIMER_MAX;	//OCR0A
+static volatile uint16_t refresh_k = 256;		//(timer_top + 1) / (TIMER_MAX + 1), 8.8
+static volatile uint16_t refresh_time = DWELL_TIME(256);	//czas ramki w ramkach nominalnych, 8.8
+//najdłuższy czas ramki - frame_clock + czas mieści się w 16 bitach
+#define FRAME_TIME_MAX 0xff00
+
+//cykle zegara na pełną ramkę nominalną
+#define FRAME_CYCLES ((uint32_t)PRESKALER_DIV * (TIMER_MAX + 1) * SCAN_SLOTS)
+
+//czekanie na BOTTOM po przepełnieniu, symulator (sim) krokuje w tym czasie timer
+#ifndef TIMER_WAIT_BOTTOM
+#define TIMER_WAIT_BOTTOM(top) while(TCNT0 == (top))
+#endif
+
+#ifdef DISPLAY_SLOT_DWELL
+/*
+ * Czas slotu wpisywany przez przerwania (DISPLAY_SLOT_DWELL)
+ * OCR0A i OCR0B buforowane są do BOTTOM, a przepełnienie zgłaszane w takcie TOP - wpis z
+ * przerwania skanowania obowiązywałby już w bieżącym slocie. Przerwanie skanowania liczy więc
+ * TOP i OCR0B następnego slotu do dwell_next_top/dwell_next_ocr, a do rejestrów przepisuje je
+ * wygaszenie (TIMER0_COMPB_vect) - kilka instrukcji, bez czekania na BOTTOM. Wygaszenie
+ * występuje raz w slocie, po przerwaniu skanowania, które slot rozpoczęło (przy OCR0B == TOP
+ * w takcie TOP, ale przed kolejnym przepełnieniem - wyższy priorytet). OCR0B ograniczone jest
+ * o dwell_margin taktów przed TOP, aby przepisanie zdążyło przed BOTTOM.
+ * TOP slotu liczony z timer_top, reszta przenoszona na kolejne sloty, więc ramka trwa
+ * średnio dokładnie DWELL_TIME(refresh_time).
+ */
+//cykle od compare match do wpisu OCR0B w wygaszeniu, z zapasem
+#if defined(DISPLAY_BLANK_TOGGLE)
+#define DWELL_LOAD_CYCLES 24
+#elif defined(DISPLAY_STATS)
+#define DWELL_LOAD_CYCLES 64
+#else
+#define DWELL_LOAD_CYCLES 40
+#endif
+
+//OCR0B slotu nominalnego - jasność bieżącej ramki
+static volatile uint8_t dwell_ocr = TIMER_MAX;
+static uint8_t dwell_acc;			//reszta TOP, 1/DWELL_ONE taktu
+static volatile uint8_t dwell_margin = DWELL_LOAD_CYCLES / PRESKALER_DIV;
+//wartości następnego slotu dla wygaszenia
+static volatile uint8_t dwell_next_top = TIMER_MAX;
+static volatile uint8_t dwell_next_ocr = TIMER_MAX;
+#ifdef DISPLAY_SCAN_PRIORITY
+//wygaszenie przepisało wartości w trakcie frame_next (DISPLAY_SCAN_PRIORITY)
+static volatile uint8_t dwell_loaded;
+#define DWELL_LOADED_CLEAR dwell_loaded = 0;
+#else
+#define DWELL_LOADED_CLEAR
+#endif
+
+//OCR0B slotu nominalnego; przerwanie przeskalowuje go dla kolejnych slotów
+#define SLOT_OCR_SET(ocr) dwell_ocr = (ocr);
+
+//TOP i OCR0B slotu counter ramki
+static void dwell_calc(frame_type *frame, uint8_t counter)
+{
+	uint8_t dwell = frame->slot[scan_plane][counter].dwell;
+	uint16_t top = (uint16_t)(timer_top + 1) * dwell + dwell_acc;
+	dwell_acc = top & (DWELL_ONE - 1);
+	top >>= DWELL_SHIFT;
+	uint8_t ocr_max = (top > dwell_margin) ? top - 1 - dwell_margin : 0;
+	uint16_t ocr = ((uint16_t)dwell_ocr * dwell + DWELL_ONE / 2) >> DWELL_SHIFT;
+	dwell_next_top = top - 1;
+	dwell_next_ocr = (ocr > ocr_max) ? ocr_max : ocr;
+}
+
+//wpis dla pierwszego slotu przy zatrzymanym timerze, także dla wygaszenia przed startem
+static void dwell_load(frame_type *frame)
+{
+	if(!FRAME_LEN(frame)) {
+		return;
+	}
+	dwell_calc(frame, 0);
+	OCR0A = dwell_next_top;
+	OCR0B = dwell_next_ocr;
+}
+
+//z przerwania skanowania, po przełączeniu slotu - wartości dla następnego
+static inline void dwell_next(uint8_t counter)
+{
+	//pusta ramka zatrzymała timer - licznik stoi
+	if(!FRAME_LEN(scan_frame)) {
+		return;
+	}
+	dwell_calc(scan_frame, counter);
+#ifdef DISPLAY_SCAN_PRIORITY
+	//wygaszenie w trakcie frame_next przepisało wartości poprzedniego slotu - jest już po BOTTOM
+	if(!counter && dwell_loaded) {
+		OCR0A = dwell_next_top;
+		OCR0B = dwell_next_ocr;
+	}
+#endif
+}
+
+//z wygaszenia - wartości następnego slotu do buforów OCR0A/OCR0B
+static inline void dwell_copy(void)
+{
+	OCR0A = dwell_next_top;
+	OCR0B = dwell_next_ocr;
+#ifdef DISPLAY_SCAN_PRIORITY
+	dwell_loaded = 1;
+#endif
+}
+
+static inline void slot_dwell(scan_slot_type *slot, uint8_t index)
+{
+	slot->dwell = segment_dwell[index];
+}
+#else
+
+#define SLOT_OCR_SET(ocr) OCR0B = (ocr);
+
+static inline void dwell_load(frame_type *frame)
+{
+	(void)frame;
+}
+
+static inline void dwell_next(uint8_t counter)
+{
+	(void)counter;
+}
+
+static inline void dwell_copy(void)
+{
+}
+
+#define DWELL_LOADED_CLEAR
+#endif
+
+#ifdef DISPLAY_STATS
+/*
+ * Liczniki pracy (display_get_stats)
+ * TOV0 ustawiane jest w takcie TOP, więc odczyt TCNT0 na wejściu przerwania skanowania to
+ * opóźnienie startu slotu w taktach: TOP - 0, potem TCNT0 + 1 (reakcja na przerwanie,
+ * prolog i blokada przez inne przerwania). TOP kończącego się slotu to OCR0A odczytany na
+ * końcu poprzedniego przerwania skanowania - bufor zawiera już wtedy TOP następnego slotu
+ * (DISPLAY_SKIP_NORMALIZE, DISPLAY_SLOT_DWELL, zmiana odświeżania). Takty timera przeliczane
+ * są na cykle przy bieżącym preskalerze - display_set_refresh i DISPLAY_ADAPTIVE_HZ nie psują
+ * już zebranych wartości.
+ */
+#ifndef DISPLAY_STATS_LATE
+#define DISPLAY_STATS_LATE 128
+#endif
+
+typedef struct {
+	uint16_t min;
+	uint16_t max;
+	uint32_t sum;
+	uint32_t count;
+} stats_time_type;
+
+#define STATS_TIME_INIT { .min = UINT16_MAX }
+
+static display_stats_type stats;
+static stats_time_type stats_ovf = STATS_TIME_INIT;
+static stats_time_type stats_compb = STATS_TIME_INIT;
+static uint8_t stats_top = TIMER_MAX;		//TOP bieżącego slotu
+
+#define STATS_COUNT(field)	stats.field++;
+#define STATS_SLOT_ENTRY	uint8_t stats_entry = TCNT0;
+#define STATS_SLOT_EXIT		stats_slot(stats_entry);
+
+static uint16_t stats_cycles(uint16_t ticks)
+{
+	uint32_t cycles = (uint32_t)ticks * timer_div;
+	return (cycles > UINT16_MAX) ? UINT16_MAX : cycles;
+}
+
+static void stats_time(stats_time_type *time, uint16_t cycles)
+{
+	if(cycles < time->min) {
+		time->min = cycles;
+	}
+	if(cycles > time->max) {
+		time->max = cycles;
+	}
+	time->sum += cycles;
+	time->count++;
+}
+
+//koniec przerwania skanowania, entry - TCNT0 na wejściu
+static void stats_slot(uint8_t entry)
+{
+	uint8_t top = stats_top;
+	stats_top = OCR0A;
+	uint16_t ticks = TCNT0;
+	if(ticks < entry) {
+		ticks += top + 1;
+	}
+	if(TIFR0 & _BV(TOV0)) {
+		//kolejne przepełnienie w trakcie przerwania - następny slot się spóźni
+		stats.overruns++;
+	}
+	stats_time(&stats_ovf, stats_cycles(ticks - entry));
+	uint8_t late_ticks = (entry >= top) ? 0 : entry + 1;
+	stats.latency_hist[(late_ticks < DISPLAY_STATS_BINS) ? late_ticks : DISPLAY_STATS_BINS - 1]++;
+	uint16_t latency = stats_cycles(late_ticks);
+	if(latency > stats.latency_max) {
+		stats.latency_max = latency;
+	}
+	if(latency > DISPLAY_STATS_LATE) {
+		stats.late++;
+	}
+	stats.slots++;
+}
+
+//koniec wygaszania - compare match przy TOP kończy się już po przepełnieniu
+static void stats_blank(uint8_t entry)
+{
+	uint16_t ticks = TCNT0;
+	if(ticks < entry) {
+		ticks += OCR0A + 1;
+	}
+	stats_time(&stats_compb, stats_cycles(ticks - entry));
+}
+
+#else
+
+#define STATS_COUNT(field)
+#define STATS_SLOT_ENTRY
+#define STATS_SLOT_EXIT
+
+#endif
+
+/*
+ * Jasność postrzegana
+ * 256 poziomów -> OCR0B z korekcją gamma, tablica liczona przez kompilator z TIMER_MAX.
+ * Wartości w stałym przecinku z GAMMA_FRAC bitami ułamka: przy małych poziomach krok OCR0B
+ * jest zbyt gruby, ułamek realizowany jest ditheringiem czasowym - co ramkę OCR0B o 1 większe
+ * wg przeniesienia z akumulatora (przy 70 Hz cykl najwyżej 16 ramek).
+ */
+#ifndef DISPLAY_GAMMA
+#define DISPLAY_GAMMA 2.2
+#endif
+#define GAMMA_FRAC 4
+#define GAMMA_ONE (1 << GAMMA_FRAC)
+#define GAMMA(i) ((uint16_t)(__builtin_pow((i) / 255.0, DISPLAY_GAMMA) * TIMER_MAX * GAMMA_ONE + 0.5))
+#define GAMMA_4(i) GAMMA(i), GAMMA(i + 1), GAMMA(i + 2), GAMMA(i + 3)
+#define GAMMA_16(i) GAMMA_4(i), GAMMA_4(i + 4), GAMMA_4(i + 8), GAMMA_4(i + 12)
+#define GAMMA_64(i) GAMMA_16(i), GAMMA_16(i + 16), GAMMA_16(i + 32), GAMMA_16(i + 48)
+
+static const __flash uint16_t gamma_ocr[256] = {
+	GAMMA_64(0), GAMMA_64(64), GAMMA_64(128), GAMMA_64(192)
+};
+
+//jasność zadana, OCR0B w stałym przecinku (GAMMA_FRAC)
+static volatile uint16_t brightness_fix = TIMER_MAX * GAMMA_ONE;
+
+#if !defined(DISPLAY_SKIP_NORMALIZE) && !defined(DISPLAY_LEVEL_BITS)
+//OCR0B wpisywane co ramkę przez przerwanie
+#define BRIGHTNESS_DITHER
+//akumulator ułamka OCR0B
+static uint8_t dither;
+#endif
+
+#ifdef DISPLAY_LEVEL_BITS
+//czas świecenia płaszczyzn, najstarsza płaszczyzna dostaje pełną jasność
+static void level_timing(uint16_t fix)
+{
+	fix = ((uint32_t)fix * refresh_k) >> 8;
+	for(uint8_t p = 0; p < LEVEL_PLANES; p++) {
+		plane_ocr[p] = (((uint32_t)fix << p) + (GAMMA_ONE << (LEVEL_PLANES - 2))) >> (LEVEL_PLANES - 1 + GAMMA_FRAC);
+	}
+}
+#endif
+
+/*
+ * Płynna zmiana jasności (display_fade_to)
+ * Poziom w formacie 8.8 zmieniany przez przerwanie co ramkę, między wpisami tablicy gamma
+ * interpolacja liniowa. Ostatni krok ustawia dokładnie poziom docelowy.
+ */
+static uint16_t fade_level = 0xff00;		//bieżący poziom jasności
+static int16_t fade_step;				//zmiana poziomu na ramkę
+static uint16_t fade_frames;			//pozostałe ramki
+static uint8_t fade_target;
+static volatile bool fading;
+
+static uint16_t luminance_fix(uint16_t level)
+{
+	uint8_t i = level >> 8;
+	uint16_t fix = gamma_ocr[i];
+	if(i < 255) {
+		fix += ((uint32_t)(gamma_ocr[i + 1] - fix) * (uint8_t)level) >> 8;
+	}
+	return fix;
+}
+
+//krok zmiany jasności, wywoływane z przerwania na granicy ramki
+static inline void fade_next(void)
+{
+	if(!fading) {
+		return;
+	}
+	if(--fade_frames) {
+		fade_level += fade_step;
+	} else {
+		fade_level = (uint16_t)fade_target << 8;
+		fading = false;
+	}
+	brightness_fix = luminance_fix(fade_level);
+#ifdef DISPLAY_LEVEL_BITS
+	level_timing(brightness_fix);
+#endif
+}
+
+//zatrzymany timer - od razu poziom docelowy
+static void fade_finish(void)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if(fading) {
+			fade_frames = 1;
+			fade_next();
+		}
+	}
+}
+
+//stan drivera ustawiany przez display_driver_on/display_driver_off
+static bool driver_on;
+
+#ifdef DISPLAY_BLANK_TOGGLE
+//linie w stanie HIGH (anoda bieżącego slotu), zerowane po wygaszeniu
+#define BLANK_MASK GPIOR0
+#define BLANK_SET(mask) BLANK_MASK = (mask);
+#define BLANK_SET_ASM "out %[blank], r24\n\t"
+#else
+#define BLANK_SET(mask)
+#define BLANK_SET_ASM
+#endif
+
+static inline void lines_off(void)
+{
+#ifdef DISPLAY_BLANK_TOGGLE
+	O_PIN = BLANK_MASK;
+	BLANK_MASK = 0;
+#else
+	DISPLAY_LINES(LINE_PORT_OFF, 0)
+#endif
+	//cbi - pojedyncze bity, atomowo względem przerwań zmieniających inne piny portu
+	DISPLAY_LINES(LINE_DIR_OFF, 0)
+}
+
+static inline void timer_start(void)
+{
+	//wyczyszczenie ewentualnie wiszących przerwań
+	TIFR0 = _BV(OCF0B) | _BV(TOV0);
+	//ustawienie preskalera
+	TCCR0B |= timer_mask;
+}
+
+static inline void timer_stop(void)
+{
+	TCCR0B &= ~PRESKALER_BITS;
+}
+
+static inline bool timer_running(void)
+{
+	return TCCR0B & PRESKALER_BITS;
+}
+
+/*
+ * Wpis OCR0B na granicy ramki
+ * Przepełnienie zgłaszane jest w takcie TOP, a OCR0A i OCR0B buforowane do BOTTOM - wpis
+ * z przerwania przed BOTTOM obowiązywałby już w ostatnim slocie ramki. Czekanie najwyżej
+ * takt timera, raz na ramkę; przy zatrzymanym timerze wpis od razu. Przy DISPLAY_SLOT_DWELL
+ * rejestry przepisuje wygaszenie, bez czekania.
+ * Odczyt OCR0A zwraca bufor, nie TOP bieżącego slotu - porównanie z scan_top. Przy pracującym
+ * timerze OCR0A zmienia się tylko na granicy ramki (frame_top_set), więc w ostatnim slocie
+ * obowiązuje wartość wpisana na poprzedniej granicy.
+ */
+#ifndef DISPLAY_SLOT_DWELL
+static uint8_t scan_top = TIMER_MAX;		//ostatni wpis OCR0A
+
+static inline void frame_top_set(uint8_t top)
+{
+	OCR0A = top;
+	scan_top = top;
+}
+#endif
+
+static inline void frame_wait_bottom(void)
+{
+#ifndef DISPLAY_SLOT_DWELL
+	if(timer_running()) {
+		TIMER_WAIT_BOTTOM(scan_top);
+	}
+#endif
+}
+
+//nastawy timera dla częstotliwości ramek - liczone poza przerwaniem (dzielenia 32-bitowe)
+typedef struct {
+	uint8_t preskaler;		//indeks w preskalers
+	uint8_t top;			//timer_top
+	uint16_t k;				//refresh_k
+	uint16_t time;			//refresh_time
+#ifdef DISPLAY_SLOT_DWELL
+	uint8_t margin;			//dwell_margin
+#endif
+} refresh_timing_type;
+
+static void refresh_calc(uint8_t hz, refresh_timing_type *timing)
+{
+	uint32_t slot_hz = (uint32_t)(hz ? hz : 1) * SCAN_SLOTS;
+	uint8_t i = 0;
+	uint32_t top;
+	//najdłuższy i najkrótszy slot w 1/DWELL_ONE slotu nominalnego
+	uint8_t dwell_max = DWELL_ONE, dwell_min = DWELL_ONE;
+
+#ifdef DISPLAY_SLOT_DWELL
+	for(uint8_t s = 0; s < SEG_MAX; s++) {
+		uint8_t dwell = segment_dwell[s];
+		if(dwell > dwell_max) {
+			dwell_max = dwell;
+		}
+		if(dwell < dwell_min) {
+			dwell_min = dwell;
+		}
+	}
+#endif
+	//najmniejszy preskaler z TOP <= 255 (najdłuższego slotu), jak przy DISPLAY_REFRESH_HZ;
+	//TOP ograniczony od dołu czasem przerwań (najkrótszego slotu) i rozdzielczością jasności
+	//- odświeżanie ponad te granice jest obniżane, zanim zostanie sprawdzony zakres 8 bitów
+	uint16_t top_max = 256 * DWELL_ONE / dwell_max;
+	uint16_t div;
+	for(;;) {
+		div = preskalers[i].div;
+		uint32_t cycles = div * slot_hz;
+		top = (F_CPU + cycles / 2) / cycles;
+		uint32_t slot_min = (uint32_t)div * dwell_min;
+		uint32_t top_min = ((uint32_t)SLOT_CYCLES_MIN * DWELL_ONE + slot_min - 1) / slot_min;
+		if(top_min < TIMER_MAX_MIN + 1) {
+			top_min = TIMER_MAX_MIN + 1;
+		}
+		if(top < top_min) {
+			top = top_min;
+		}
+		if(top <= top_max || i == ARRAY_SIZE(preskalers) - 1) {
+			break;
+		}
+		i++;
+	}
+	//zbyt małe odświeżanie - najdłuższy slot przy preskalerze 1024
+	if(top > top_max) {
+		top = top_max;
+	}
+	uint32_t time = DWELL_TIME((uint32_t)top * div * 256 / ((uint32_t)(TIMER_MAX + 1) * PRESKALER_DIV));
+
+	timing->preskaler = i;
+	timing->top = top - 1;
+	timing->k = (uint32_t)top * 256 / (TIMER_MAX + 1);
+	timing->time = (time > FRAME_TIME_MAX) ? FRAME_TIME_MAX : time;
+#ifdef DISPLAY_SLOT_DWELL
+	timing->margin = DWELL_LOAD_CYCLES / div;
+#endif
+}
+
+//ustawienie timera z gotowych nastaw, także z przerwania
+static void refresh_apply(const refresh_timing_type *timing)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		timer_mask = preskalers[timing->preskaler].mask;
+		timer_div = preskalers[timing->preskaler].div;
+		timer_top = timing->top;
+		refresh_k = timing->k;
+		refresh_time = timing->time;
+#ifndef DISPLAY_SLOT_DWELL
+		//przy pracującym timerze TOP wpisuje granica ramki (frame_apply), razem z OCR0B
+		if(!timer_running()) {
+			frame_top_set(timing->top);
+		}
+#else
+		dwell_margin = timing->margin;
+#endif
+		if(timer_running()) {
+			TCCR0B = (TCCR0B & ~PRESKALER_BITS) | timer_mask;
+		}
+	}
+#if defined(DISPLAY_LEVEL_BITS)
+	level_timing(brightness_fix);
+#elif defined(BRIGHTNESS_DITHER) && defined(DISPLAY_SLOT_DWELL)
+	//TOP slotu liczony od razu z timer_top - OCR0B razem z nim
+	SLOT_OCR_SET((((uint32_t)brightness_fix * refresh_k) >> 8) >> GAMMA_FRAC)
+#elif defined(BRIGHTNESS_DITHER)
+	//przy pracującym timerze OCR0B dla nowego TOP wpisuje granica ramki (frame_apply)
+	if(!timer_running()) {
+		SLOT_OCR_SET((((uint32_t)brightness_fix * refresh_k) >> 8) >> GAMMA_FRAC)
+	}
+#endif
+}
+
+static void refresh_set(uint8_t hz)
+{
+	refresh_timing_type timing;
+	refresh_calc(hz, &timing);
+	refresh_apply(&timing);
+}
+
+#ifdef DISPLAY_SKIP_BLANK
+/*
+ * Czas ramki
+ * Ramka z pominiętymi slotami jest krótsza, frame->time (256 - pełna ramka) odmierza czas
+ * zmian jasności i animacji niezależnie od liczby zapalonych slotów.
+ *
+ * Normalizacja czasu ramki (DISPLAY_SKIP_NORMALIZE)
+ * Przy n zapalonych slotach okres slotu wydłużany jest tak, aby ramka trwała tyle co
+ * pełne SCAN_SLOTS slotów (do granicy 8 bitów timera). Resztę kompensuje przeskalowanie
+ * OCR0B, więc wypełnienie każdego segmentu nie zależy od liczby zapalonych.
+ * Wartości wpisuje przerwanie na granicy ramki po BOTTOM (frame_wait_bottom) - OCR0A i OCR0B
+ * buforowane w trybie 7 obowiązują wtedy od pierwszego slotu nowej ramki.
+ */
+static void frame_timing(frame_type *frame)
+{
+	uint8_t len = frame->len;
+	if(!len) {
+		return;
+	}
+#ifdef DISPLAY_SKIP_NORMALIZE
+	uint16_t top = (uint16_t)(timer_top + 1) * SCAN_SLOTS / len;
+	if(top > 256) {
+		top = 256;
+	}
+	frame->top = top - 1;
+	//skala względem ramki nominalnej, nie przekracza 65536 / GAMMA_ONE * refresh_k / 256
+	uint32_t scale = (uint32_t)top * len * (65536 / GAMMA_ONE) / ((uint16_t)(TIMER_MAX + 1) * SCAN_SLOTS);
+	frame->scale = (scale > 0xffff) ? 0xffff : scale;
+	uint32_t time = ((scale * timer_div) >> (16 - GAMMA_FRAC - 8)) / PRESKALER_DIV;
+#elif defined(DISPLAY_SLOT_DWELL)
+	uint16_t dwell = 0;
+	for(uint8_t i = 0; i < len; i++) {
+		dwell += frame->slot[0][i].dwell;
+	}
+	uint32_t time = (uint32_t)refresh_time * dwell / DWELL_SUM;
+#else
+	uint32_t time = (uint32_t)refresh_time * len / SCAN_SLOTS;
+#endif
+	frame->time = (time > FRAME_TIME_MAX) ? FRAME_TIME_MAX : time;
+}
+#else
+static inline void frame_timing(frame_type *frame)
+{
+	(void)frame;
+}
+#endif
+
+//ułamek pełnej ramki przeniesiony z poprzednich ramek
+static uint8_t frame_clock;
+
+#ifdef DISPLAY_TICK_MS
+/*
+ * Tick aplikacji z przerwania wyświetlacza
+ * Co pełną ramkę dolicza się jej czas w cyklach zegara, display_tick wywoływany jest po
+ * odliczeniu DISPLAY_TICK_MS - średnio dokładnie, z rozrzutem do jednej ramki.
+ */
+#define TICK_CYCLES ((uint32_t)(F_CPU / 1000) * DISPLAY_TICK_MS)
+_Static_assert(TICK_CYCLES >= FRAME_CYCLES, "DISPLAY_TICK_MS krótszy niż czas ramki");
+
+static uint32_t tick_cycles;
+
+static inline void tick_next(void)
+{
+	tick_cycles += FRAME_CYCLES;
+	if(tick_cycles >= TICK_CYCLES) {
+		tick_cycles -= TICK_CYCLES;
+		display_tick();
+	}
+}
+#else
+static inline void tick_next(void)
+{
+}
+#endif
+
+#ifdef DISPLAY_ADAPTIVE_HZ
+/*
+ * Adaptacyjne odświeżanie
+ * Statyczna treść - bez display_commit, animacji, migania i zmiany jasności przez
+ * DISPLAY_ADAPTIVE_MS - obniża częstotliwość ramek o połowę odległości do DISPLAY_ADAPTIVE_HZ,
+ * kolejne kroki co DISPLAY_ADAPTIVE_MS. Jasność nie zmienia się (refresh_k), display_commit
+ * od razu przywraca częstotliwość bazową.
+ * Nastawy timera wszystkich kroków liczy display_init i display_set_refresh (adapt_plan),
+ * przerwanie tylko je wpisuje - dzielenia refresh_calc trwają dłużej niż slot.
+ */
+#ifndef DISPLAY_ADAPTIVE_MS
+#define DISPLAY_ADAPTIVE_MS 1000
+#endif
+#define ADAPT_FRAMES ((uint32_t)DISPLAY_ADAPTIVE_MS * (F_CPU / 1000) / FRAME_CYCLES)
+_Static_assert(DISPLAY_ADAPTIVE_HZ < DISPLAY_REFRESH_HZ, "DISPLAY_ADAPTIVE_HZ nie mniejsze niż DISPLAY_REFRESH_HZ");
+_Static_assert(ADAPT_FRAMES > 0 && ADAPT_FRAMES <= UINT16_MAX, "nieprawidłowe DISPLAY_ADAPTIVE_MS");
+
+//częstotliwość bazowa i kolejne kroki - odległość do DISPLAY_ADAPTIVE_HZ (< 255) maleje
+//o połowę, więc najwyżej 8 kroków
+#define ADAPT_STEPS 9
+
+static refresh_timing_type adapt_steps[ADAPT_STEPS];	//[0] - bazowa, display_set_refresh
+static volatile uint8_t adapt_len;						//liczba nastaw w adapt_steps
+static uint8_t adapt_step;								//bieżąca nastawa
+static uint16_t adapt_frames;						//ramki nominalne bez zmian
+
+//nastawy kroków dla częstotliwości bazowej, poza przerwaniem
+static void adapt_plan(uint8_t hz)
+{
+	uint8_t len = 0;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		adapt_len = 0;
+		adapt_step = 0;
+		adapt_frames = 0;
+	}
+	for(;;) {
+		refresh_calc(hz, &adapt_steps[len++]);
+		if(hz <= DISPLAY_ADAPTIVE_HZ) {
+			break;
+		}
+		hz = DISPLAY_ADAPTIVE_HZ + (hz - DISPLAY_ADAPTIVE_HZ) / 2;
+	}
+	//bariera pamięci - tablica zapisana przed udostępnieniem przerwaniu
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		adapt_len = len;
+	}
+}
+
+//co ramkę nominalną, z przerwania
+static inline void adapt_next(void)
+{
+	if(anim_mask || blink_mask || fading) {
+		adapt_frames = 0;
+		return;
+	}
+	if(adapt_step + 1 >= adapt_len || ++adapt_frames < ADAPT_FRAMES) {
+		return;
+	}
+	adapt_frames = 0;
+	refresh_apply(&adapt_steps[++adapt_step]);
+#ifdef DISPLAY_SKIP_BLANK
+	//czas i TOP ramki zależą od odświeżania - ramka tylna do przeliczenia
+	anim_dirty = true;
+#endif
+}
+
+//zmiana treści, wywoływane przez display_commit
+static void adapt_restore(void)
+{
+	bool lowered;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		adapt_frames = 0;
+		lowered = adapt_step != 0;
+		adapt_step = 0;
+	}
+	if(lowered) {
+		refresh_apply(&adapt_steps[0]);
+	}
+}
+#else
+static inline void adapt_plan(uint8_t hz)
+{
+	(void)hz;
+}
+
+static inline void adapt_next(void)
+{
+}
+
+static inline void adapt_restore(void)
+{
+}
+#endif
+
+//liczba upłyniętych ramek nominalnych, wywoływane z przerwania na granicy ramki
+static inline uint8_t frame_tick(frame_type *frame)
+{
+	(void)frame;
+	uint16_t time = frame_clock + FRAME_TIME(frame);
+	frame_clock = time;
+	return time >> 8;
+}
+
+#ifdef DISPLAY_SKIP_NORMALIZE
+
+//co ramkę - jasność może się zmieniać w trakcie display_fade_to
+static inline void frame_apply(frame_type *frame)
+{
+	frame_wait_bottom();
+	frame_top_set(frame->top);
+	OCR0B = ((uint32_t)brightness_fix * frame->scale) >> 16;
+}
+#else
+
+//co ramkę - OCR0B płaszczyzny albo z ditheringiem
+static inline void frame_apply(frame_type *frame)
+{
+	(void)frame;
+#ifdef DISPLAY_LEVEL_BITS
+	//waga płaszczyzny od pierwszego slotu ramki
+	frame_wait_bottom();
+	SLOT_OCR_SET(plane_ocr[scan_plane])
+#endif
+#ifndef DISPLAY_SLOT_DWELL
+	//TOP po display_set_refresh i DISPLAY_ADAPTIVE_HZ razem z OCR0B przeliczonym dla niego
+	if(scan_top != timer_top) {
+		frame_top_set(timer_top);
+	}
+#endif
+#ifdef BRIGHTNESS_DITHER
+	uint16_t fix = ((uint32_t)brightness_fix * refresh_k) >> 8;
+	dither = (dither & (GAMMA_ONE - 1)) + (fix & (GAMMA_ONE - 1));
+	SLOT_OCR_SET((fix >> GAMMA_FRAC) + (dither >> GAMMA_FRAC))
+#endif
+}
+#endif
+
+#if defined(DISPLAY_ISR_ASM)
+static inline void slot_set(scan_slot_type *slot, segment_type seg)
+{
+	slot->dir = seg.active_mask | (O_DIR & DISPLAY_LINES_NEG_MASK);
+	slot->anode = seg.anode_mask;
+	slot->last = 0;
+}
+
+static inline void slot_close(scan_slot_type *slot, uint8_t len)
+{
+	if(len) {
+		slot[len - 1].last = 1;
+	}
+}
+
+//wskaźnik bieżącego slotu dla przerwania trzymany w GPIOR1:GPIOR2
+static inline void slot_rewind(frame_type *frame)
+{
+	uintptr_t ptr = (uintptr_t)&frame->slot[scan_plane][0];
+	GPIOR1 = (uint8_t)ptr;
+	GPIOR2 = (uint8_t)(ptr >> 8);
+}
+#elif defined(DISPLAY_SLOT_DWELL)
+//slot bez segmentu (pusty slot ramki z animacją) trwa jak nominalny
+static inline void slot_set(scan_slot_type *slot, segment_type seg)
+{
+	slot->seg = seg;
+	slot->dwell = DWELL_ONE;
+}
+
+static inline void slot_close(scan_slot_type *slot, uint8_t len)
+{
+	(void)slot;
+	(void)len;
+}
+
+static inline segment_type slot_fetch(frame_type *frame, uint8_t counter)
+{
+	return frame->slot[scan_plane][counter].seg;
+}
+
+static inline void slot_rewind(frame_type *frame)
+{
+	(void)frame;
+}
+#elif defined(SCAN_RENDERED)
+static inline void slot_set(scan_slot_type *slot, segment_type seg)
+{
+	*slot = seg;
+}
+
+static inline void slot_close(scan_slot_type *slot, uint8_t len)
+{
+	(void)slot;
+	(void)len;
+}
+
+static inline segment_type slot_fetch(frame_type *frame, uint8_t counter)
+{
+	return frame->slot[scan_plane][counter];
+}
+
+static inline void slot_rewind(frame_type *frame)
+{
+	(void)frame;
+}
+#else
+//bity ramki do końca bieżącej ramki, bit 0 to segment bieżącego slotu
+static screen_type scan_bits;
+
+static inline segment_type slot_fetch(frame_type *frame, uint8_t counter)
+{
+	segment_type seg = {0, 0};
+	(void)frame;
+	if((uint8_t)scan_bits & 1) {
+		seg = segments[counter];
+	}
+	scan_bits >>= 1;
+	return seg;
+}
+
+static inline void slot_rewind(frame_type *frame)
+{
+	scan_bits = frame->mask[scan_plane];
+}
+#endif
+
+#ifdef DISPLAY_SCAN_ANODE
+#define LINE_ENTRY(p, line) LINE_MASK(line),
+__flash static uint8_t const line_masks[LINES_NO] = {
+		DISPLAY_LINES(LINE_ENTRY, 0)
+};
+#endif
+
+/*
+ * Przeliczenie pamięci ekranu na sloty skanowania
+ * W trybie anodowym segmenty grupowane są według anody. Anoda slotu jest stała, zmieniają się
+ * tylko katody. Segmenty o tej samej anodzie ponad limit DISPLAY_SLOT_SEGS trafiają do kolejnego
+ * slotu tej anody.
+ * Przy DISPLAY_SKIP_BLANK puste sloty są pomijane.
+ */
+#ifdef SCAN_RENDERED
+static uint8_t plane_render(scan_slot_type *slot, screen_type bits)
+{
+	uint8_t len = 0;
+#ifdef DISPLAY_SCAN_ANODE
+	uint8_t used[LINES_NO] = {0};
+	uint8_t active[SCAN_SLOTS] = {0};
+
+	for(uint8_t i = 0; bits; i++, bits >>= 1) {
+		if(!(bits & 1)) {
+			continue;
+		}
+		segment_type seg = segments[i];
+		uint8_t line = 0;
+		while(line_masks[line] != seg.anode_mask) {
+			line++;
+		}
+		active[line * ANODE_SLOTS + used[line]++ / DISPLAY_SLOT_SEGS] |= seg.active_mask;
+	}
+	for(uint8_t i = 0; i < SCAN_SLOTS; i++) {
+#ifdef DISPLAY_SKIP_BLANK
+		if(!active[i]) {
+			continue;
+		}
+#endif
+		uint8_t anode = line_masks[i / ANODE_SLOTS];
+		slot_set(&slot[len++], (segment_type){ active[i] | anode, anode });
+	}
+#elif defined(DISPLAY_SKIP_BLANK)
+	for(uint8_t i = 0; bits; i++, bits >>= 1) {
+		if(bits & 1) {
+			slot_set(&slot[len], segments[i]);
+#ifdef DISPLAY_SLOT_DWELL
+			slot_dwell(&slot[len], i);
+#endif
+			len++;
+		}
+	}
+#else
+	for(; len < SCAN_SLOTS; len++, bits >>= 1) {
+		segment_type seg = {0, 0};
+		if(bits & 1) {
+			seg = segments[len];
+		}
+		slot_set(&slot[len], seg);
+#ifdef DISPLAY_SLOT_DWELL
+		slot_dwell(&slot[len], len);
+#endif
+	}
+#endif
+	slot_close(slot, len);
+	return len;
+}
+#endif
+
+/*
+ * Przeliczenie ramki z opublikowanej pamięci ekranu i warstwy animacji
+ * Wywoływane przez display_commit albo przez przerwanie (frame_render). Warstwy zmieniane
+ * przez przerwanie czytane są bez cli() - odczyt powtarzany po zmianie layers_seq.
+ */
+static void scan_render(frame_type *frame)
+{
+	screen_type screen;
 
-#define DIGIT_SEGS_NO	7
-#define FLAG_SEGS_NO	1
-#define FILL_SEGS_NO	4
-#define DROP_SEGS_NO	5
-
-static union {
-	struct areas{ //
-		segment_type tens[ DIGIT_SEGS_NO ];
-		segment_type units[ DIGIT_SEGS_NO ];
-		segment_type power[ FLAG_SEGS_NO ];
-		segment_type percent[ FLAG_SEGS_NO ];
-		segment_type fill[ FILL_SEGS_NO ];
-		segment_type droplet[ DROP_SEGS_NO ];
-	} areas;
-	segment_type buffer[sizeof(struct areas)/sizeof(segment_type)];
-//	uint8_t buffer[sizeof(struct areas)];
-} display;
+#ifdef DISPLAY_SKIP_BLANK
+	bool overlay;
+#endif
+
+	uint8_t seq;
+	do {
+		seq = layers_seq;
+		screen = ((shown & ~anim_mask) | anim_bits) & ~blink_off;
+#ifdef DISPLAY_SKIP_BLANK
+#ifdef DISPLAY_TICK_MS
+		overlay = true;
+#else
+		overlay = anim_mask || blink_mask;
+#endif
+#endif
+	} while(seq != layers_seq);
+	for(uint8_t p = 0; p < LEVEL_PLANES; p++) {
+#ifdef SCAN_RENDERED
+		uint8_t len = plane_render(frame->slot[p], PLANE_BITS(screen, p));
+#ifdef DISPLAY_SKIP_BLANK
+		//animacja, miganie i tick odmierzają czas ramkami - timer nie może stanąć, jeden pusty slot
+		if(!len && overlay) {
+			slot_set(&frame->slot[p][0], (segment_type){0, 0});
+			slot_close(frame->slot[p], 1);
+			len = 1;
+		}
+		frame->len = len;
+		frame_timing(frame);
+#else
+		(void)len;
+#endif
+#else
+		frame->mask[p] = PLANE_BITS(screen, p);
+#endif
+	}
+}
 
 /*
  * Opisy obiektów
+ * Glif to bajt, bit i zapala i-ty segment obszaru
  */
+//segmenty cyfry - indeksy obszarów TENS i UNITS w mapie segmentów
+#define DIGIT_D _BV(0)
+#define DIGIT_E _BV(1)
+#define DIGIT_F _BV(2)
+#define DIGIT_A _BV(3)
+#define DIGIT_B _BV(4)
+#define DIGIT_C _BV(5)
+#define DIGIT_G _BV(6)
+
 enum units_entities_tag {
 	UNITS_0,
 	UNITS_1,
@@ -140,20 +1431,20 @@ enum units_entities_tag {
 	UNITS_DASH,
 	UNITS_MAX,
 };
-__flash static segment_type const units_entities[][ARRAY_SIZE(display.areas.units)] ={
-
-		[UNITS_0] = {SEG_8, SEG_9, SEG_10, SEG_11, SEG_12, SEG_13},
-		[UNITS_1] = {SEG_12, SEG_13},
-		[UNITS_2] = {SEG_8, SEG_9, SEG_11, SEG_12, SEG_14},
-		[UNITS_3] = {SEG_8, SEG_11, SEG_12, SEG_13, SEG_14},
-		[UNITS_4] = {SEG_10, SEG_12, SEG_13, SEG_14},
-		[UNITS_5] = {SEG_8, SEG_10, SEG_11, SEG_13, SEG_14},
-		[UNITS_6] = {SEG_8, SEG_9, SEG_10, SEG_11, SEG_13, SEG_14},
-		[UNITS_7] = {SEG_11, SEG_12, SEG_13},
-		[UNITS_8] = {SEG_8, SEG_9, SEG_10, SEG_11, SEG_12, SEG_13, SEG_14},
-		[UNITS_9] = {SEG_8, SEG_10, SEG_11, SEG_12, SEG_13, SEG_14},
-		[UNITS_BLANK] = {},
-		[UNITS_DASH] = {SEG_14},
+__flash static uint8_t const units_entities[] ={
+
+		[UNITS_0] = DIGIT_D | DIGIT_E | DIGIT_F | DIGIT_A | DIGIT_B | DIGIT_C,
+		[UNITS_1] = DIGIT_B | DIGIT_C,
+		[UNITS_2] = DIGIT_D | DIGIT_E | DIGIT_A | DIGIT_B | DIGIT_G,
+		[UNITS_3] = DIGIT_D | DIGIT_A | DIGIT_B | DIGIT_C | DIGIT_G,
+		[UNITS_4] = DIGIT_F | DIGIT_B | DIGIT_C | DIGIT_G,
+		[UNITS_5] = DIGIT_D | DIGIT_F | DIGIT_A | DIGIT_C | DIGIT_G,
+		[UNITS_6] = DIGIT_D | DIGIT_E | DIGIT_F | DIGIT_A | DIGIT_C | DIGIT_G,
+		[UNITS_7] = DIGIT_A | DIGIT_B | DIGIT_C,
+		[UNITS_8] = DIGIT_D | DIGIT_E | DIGIT_F | DIGIT_A | DIGIT_B | DIGIT_C | DIGIT_G,
+		[UNITS_9] = DIGIT_D | DIGIT_F | DIGIT_A | DIGIT_B | DIGIT_C | DIGIT_G,
+		[UNITS_BLANK] = 0,
+		[UNITS_DASH] = DIGIT_G,
 
 };
 _Static_assert(ARRAY_SIZE(units_entities)==UNITS_MAX, "nieprawidowa tablica units");
@@ -174,21 +1465,21 @@ enum tens_entities_tag {
 	TENS_MAX,
 	TENS_BLANK = TENS_0, //zera wiodącego nie wyświetlamy
 };
-__flash static segment_type const tens_entities[][ARRAY_SIZE(display.areas.tens)] ={
-
-//		[TENS_0] = {SEG_1, SEG_2, SEG_3, SEG_4, SEG_5, SEG_6},
-		[TENS_0] = {},
-		[TENS_1] = {SEG_5, SEG_6},
-		[TENS_2] = {SEG_1, SEG_2, SEG_4, SEG_5, SEG_7},
-		[TENS_3] = {SEG_1, SEG_4, SEG_5, SEG_6, SEG_7},
-		[TENS_4] = {SEG_3, SEG_5, SEG_6, SEG_7},
-		[TENS_5] = {SEG_1, SEG_3, SEG_4, SEG_6, SEG_7},
-		[TENS_6] = {SEG_1, SEG_2, SEG_3, SEG_4, SEG_6, SEG_7},
-		[TENS_7] = {SEG_4, SEG_5, SEG_6},
-		[TENS_8] = {SEG_1, SEG_2, SEG_3, SEG_4, SEG_5, SEG_6, SEG_7},
-		[TENS_9] = {SEG_1, SEG_3, SEG_4, SEG_5, SEG_6, SEG_7},
-		[TENS_ERROR] = {SEG_1, SEG_2, SEG_3, SEG_4, SEG_7},
-		[TENS_DASH] = {SEG_7},
+__flash static uint8_t const tens_entities[] ={
+
+//		[TENS_0] = DIGIT_D | DIGIT_E | DIGIT_F | DIGIT_A | DIGIT_B | DIGIT_C,
+		[TENS_0] = 0,
+		[TENS_1] = DIGIT_B | DIGIT_C,
+		[TENS_2] = DIGIT_D | DIGIT_E | DIGIT_A | DIGIT_B | DIGIT_G,
+		[TENS_3] = DIGIT_D | DIGIT_A | DIGIT_B | DIGIT_C | DIGIT_G,
+		[TENS_4] = DIGIT_F | DIGIT_B | DIGIT_C | DIGIT_G,
+		[TENS_5] = DIGIT_D | DIGIT_F | DIGIT_A | DIGIT_C | DIGIT_G,
+		[TENS_6] = DIGIT_D | DIGIT_E | DIGIT_F | DIGIT_A | DIGIT_C | DIGIT_G,
+		[TENS_7] = DIGIT_A | DIGIT_B | DIGIT_C,
+		[TENS_8] = DIGIT_D | DIGIT_E | DIGIT_F | DIGIT_A | DIGIT_B | DIGIT_C | DIGIT_G,
+		[TENS_9] = DIGIT_D | DIGIT_F | DIGIT_A | DIGIT_B | DIGIT_C | DIGIT_G,
+		[TENS_ERROR] = DIGIT_D | DIGIT_E | DIGIT_F | DIGIT_A | DIGIT_G,
+		[TENS_DASH] = DIGIT_G,
 
 };
 _Static_assert(ARRAY_SIZE(tens_entities)==TENS_MAX, "nieprawidowa tablica tens");
@@ -198,9 +1489,9 @@ enum power_entities_tag {
 	POWER,
 	POWER_MAX,
 };
-__flash static segment_type const power_entities[][ARRAY_SIZE(display.areas.power)] = {
-		[POWER] = {SEG_16},
-		[POWER_BLANK] = {},
+__flash static uint8_t const power_entities[] = {
+		[POWER] = _BV(0),	//SEG_16
+		[POWER_BLANK] = 0,
 };
 _Static_assert(ARRAY_SIZE(power_entities)==POWER_MAX, "nieprawidowa tablica power");
 
@@ -209,12 +1500,18 @@ enum percent_entities_tag {
 	PERCENT,
 	PERCENT_MAX,
 };
-__flash static segment_type const percent_entities[][ARRAY_SIZE(display.areas.percent)] = {
-		[PERCENT] = {SEG_15},
-		[PERCENT_BLANK] = {},
+__flash static uint8_t const percent_entities[] = {
+		[PERCENT] = _BV(0),	//SEG_15
+		[PERCENT_BLANK] = 0,
 };
 _Static_assert(ARRAY_SIZE(percent_entities)==PERCENT_MAX, "nieprawidowa tablica percent");
 
+//segmenty wypełnienia, kolejność SEG_17..SEG_20
+#define FILL_17 _BV(0)
+#define FILL_18 _BV(1)
+#define FILL_19 _BV(2)
+#define FILL_20 _BV(3)
+
 enum fill_entities_tag {
 		FILL_ENT_1,
 		FILL_ENT_2,
@@ -224,16 +1521,23 @@ enum fill_entities_tag {
 		FILL_ENT_BLANK,
 		FILL_ENT_MAX,
 };
-__flash static segment_type const fill_entities[][ARRAY_SIZE(display.areas.fill)] = {
-		[FILL_ENT_1] = {SEG_20},
-		[FILL_ENT_2] = {SEG_19},
-		[FILL_ENT_3] = {SEG_18},
-		[FILL_ENT_4] = {SEG_17},
-		[FILL_ENT_ALL] = {SEG_17, SEG_18, SEG_19, SEG_20},
-		[FILL_ENT_BLANK] = {},
+__flash static uint8_t const fill_entities[] = {
+		[FILL_ENT_1] = FILL_20,
+		[FILL_ENT_2] = FILL_19,
+		[FILL_ENT_3] = FILL_18,
+		[FILL_ENT_4] = FILL_17,
+		[FILL_ENT_ALL] = FILL_17 | FILL_18 | FILL_19 | FILL_20,
+		[FILL_ENT_BLANK] = 0,
 };
 _Static_assert(ARRAY_SIZE(fill_entities)==FILL_ENT_MAX, "nieprawidowa tablica fill");
 
+//segmenty kropli, kolejność SEG_21..SEG_25
+#define DROP_21 _BV(0)
+#define DROP_22 _BV(1)
+#define DROP_23 _BV(2)
+#define DROP_24 _BV(3)
+#define DROP_25 _BV(4)
+
 enum drop_entities_tag {
 	DROP_ENT_1,
 	DROP_ENT_2,
@@ -244,123 +1548,656 @@ enum drop_entities_tag {
 	DROP_ENT_BLANK,
 	DROP_ENT_MAX
 };
-__flash static segment_type const drop_entities[][ARRAY_SIZE(display.areas.droplet)] = {
-		[DROP_ENT_1] = {SEG_24},
-		[DROP_ENT_2] = {SEG_25},
-		[DROP_ENT_3] = {SEG_21},
-		[DROP_ENT_4] = {SEG_22},
-		[DROP_ENT_5] = {SEG_23},
-		[DROP_ENT_ALL] = {SEG_24, SEG_25, SEG_21, SEG_22, SEG_23},
-		[DROP_ENT_BLANK] = {},
+__flash static uint8_t const drop_entities[] = {
+		[DROP_ENT_1] = DROP_24,
+		[DROP_ENT_2] = DROP_25,
+		[DROP_ENT_3] = DROP_21,
+		[DROP_ENT_4] = DROP_22,
+		[DROP_ENT_5] = DROP_23,
+		[DROP_ENT_ALL] = DROP_24 | DROP_25 | DROP_21 | DROP_22 | DROP_23,
+		[DROP_ENT_BLANK] = 0,
 
 };
 _Static_assert(ARRAY_SIZE(drop_entities)==DROP_ENT_MAX, "nieprawidowa tablica drop");
 
+/*
+ * dla liczb większych niż maksymalna wyświetla --
+ * dla liczb z ustawionym najstarszym bitem wyświetla E i numer błędu
+ */
+static uint16_t number_glyph(uint8_t val)
+{
+	uint8_t tens, units;
+
+	if(val&0x80) {
+		tens = tens_entities[TENS_ERROR];
+		units = units_entities[(val & 0x0f) % 11];
+	} else if(val>MAX_NUMBER) {
+		tens = tens_entities[TENS_DASH];
+		units = units_entities[UNITS_DASH];
+	} else {
+		tens = tens_entities[val / 10];
+		units = units_entities[val % 10];
+	}
+	return tens | ((uint16_t)units << (UNITS_SHIFT - TENS_SHIFT));
+}
+
+/*
+ * Animacje
+ * Każdy obszar ma własny kanał odtwarzający sekwencję klatek z pamięci programu. Kanały
+ * liczy przerwanie co czas pełnej ramki, zmiana klatki ustawia glif w warstwie animacji,
+ * a ramkę tylną przelicza przerwanie (frame_render) - bez udziału pętli głównej.
+ */
+typedef struct {
+	const __flash display_anim_type *anim;	//NULL - kanał wolny
+	uint8_t key;							//bieżąca klatka
+	uint8_t loops;							//pozostałe powtórzenia, 0 - bez końca
+	uint16_t left;							//pełne ramki do następnej klatki
+} anim_channel_type;
+
+static anim_channel_type anim_channels[DISPLAY_AREA_MAX];
+
+__flash static uint8_t const area_shifts[] = {
+		[DISPLAY_AREA_NUMBER] = NUMBER_SHIFT,
+		[DISPLAY_AREA_PERCENT] = PERCENT_SHIFT,
+		[DISPLAY_AREA_POWER] = POWER_SHIFT,
+		[DISPLAY_AREA_FILL] = FILL_SHIFT,
+		[DISPLAY_AREA_DROP] = DROP_SHIFT,
+};
+_Static_assert(ARRAY_SIZE(area_shifts)==DISPLAY_AREA_MAX, "nieprawidowa tablica area");
+
+__flash static screen_type const area_masks[] = {
+		[DISPLAY_AREA_NUMBER] = AREA_MASK(NUMBER),
+		[DISPLAY_AREA_PERCENT] = AREA_MASK(PERCENT),
+		[DISPLAY_AREA_POWER] = AREA_MASK(POWER),
+		[DISPLAY_AREA_FILL] = AREA_MASK(FILL),
+		[DISPLAY_AREA_DROP] = AREA_MASK(DROP),
+};
+_Static_assert(ARRAY_SIZE(area_masks)==DISPLAY_AREA_MAX, "nieprawidowa tablica area");
+
+//stan klatki jak argument setera obszaru
+static uint16_t area_glyph(uint8_t area, uint8_t state)
+{
+	switch(area) {
+	case DISPLAY_AREA_NUMBER:
+		return number_glyph(state);
+	case DISPLAY_AREA_PERCENT:
+		return percent_entities[state != 0];
+	case DISPLAY_AREA_POWER:
+		return power_entities[state != 0];
+	case DISPLAY_AREA_FILL:
+		return fill_entities[state % FILL_ENT_MAX];
+	default:
+		return drop_entities[state % DROP_ENT_MAX];
+	}
+}
+
+//czas klatki w 10 ms -> pełne ramki, współczynnik 8.8
+#define ANIM_FRAMES_K ((uint16_t)(F_CPU / 100 * 256 / FRAME_CYCLES))
+
+//następna klatka kanału, po ostatnim powtórzeniu obszar wraca do pamięci ekranu
+static void anim_key(uint8_t area)
+{
+	anim_channel_type *ch = &anim_channels[area];
+	const __flash display_anim_type *anim = ch->anim;
+	screen_type mask = area_masks[area];
+
+	if(++ch->key >= anim->len) {
+		ch->key = 0;
+		if(ch->loops && !--ch->loops) {
+			ch->anim = NULL;
+			anim_mask &= ~mask;
+			anim_bits &= ~mask;
+			layers_seq++;
+			anim_dirty = true;
+			return;
+		}
+	}
+	display_key_type key = anim->keys[ch->key];
+	uint16_t left = ((uint32_t)key.time * ANIM_FRAMES_K) >> 8;
+	ch->left = left ? left : 1;
+	anim_mask |= mask;
+	anim_bits = (anim_bits & ~mask) | ((screen_type)area_glyph(area, key.state) << area_shifts[area]);
+	layers_seq++;
+	anim_dirty = true;
+}
+
+//wywoływane z przerwania co czas pełnej ramki
+static inline void anim_next(void)
+{
+	for(uint8_t area = 0; area < DISPLAY_AREA_MAX; area++) {
+		anim_channel_type *ch = &anim_channels[area];
+		if(ch->anim && !--ch->left) {
+			anim_key(area);
+		}
+	}
+}
+
+/*
+ * Miganie
+ * Obszar migający jest wygaszany maską na granicy ramki, fazy liczone są w pełnych ramkach
+ * od wspólnego licznika blink_clock, więc obszary o tym samym okresie i przesunięciu migają
+ * razem niezależnie od chwili włączenia.
+ */
+typedef struct {
+	uint16_t on;		//ramki świecenia, 0 - kanał wolny
+	uint16_t off;		//ramki wygaszenia
+	uint16_t left;		//ramki do zmiany stanu
+	bool lit;
+} blink_channel_type;
+
+static blink_channel_type blink_channels[DISPLAY_AREA_MAX];
+//pełne ramki od startu
+static uint32_t blink_clock;
+
+//wywoływane z przerwania co czas pełnej ramki
+static inline void blink_next(void)
+{
+	blink_clock++;
+	for(uint8_t area = 0; area < DISPLAY_AREA_MAX; area++) {
+		blink_channel_type *ch = &blink_channels[area];
+		if(!ch->on || !ch->off || --ch->left) {
+			continue;
+		}
+		ch->lit = !ch->lit;
+		if(ch->lit) {
+			ch->left = ch->on;
+			blink_off &= ~area_masks[area];
+		} else {
+			ch->left = ch->off;
+			blink_off |= area_masks[area];
+		}
+		layers_seq++;
+		anim_dirty = true;
+	}
+}
+
+/*
+ * Przeliczenie ramki tylnej po zmianie klatki animacji, na końcu przerwania skanowania
+ * Nie w trakcie display_commit i nie przed zamianą opublikowanej już ramki. Przeliczenie
+ * trwa dłużej niż slot, więc idzie przy odblokowanych przerwaniach - skanowanie i
+ * wygaszanie działają dalej, render_busy blokuje ponowne wejście.
+ */
+static inline void frame_render(void)
+{
+	if(!anim_dirty || render_busy || pending) {
+		return;
+	}
+	anim_dirty = false;
+	render_busy = true;
+	frame_type *back = (scan_frame == &frames[0]) ? &frames[1] : &frames[0];
+	sei();
+	scan_render(back);
+	cli();
+	render_busy = false;
+	pending = true;
+}
+
 
 /*
  * Funkcje
  */
-void display_clear(void)
+/*
+ * Ostatni stan obszarów wpisany przez setery (liczba, poziom, flaga) - powtórzone wywołanie
+ * z tym samym stanem kończy się bez odczytu glifów z pamięci programu i bez display_commit
+ */
+#define STATE_NONE	0xffff		//nieznany - pierwszy zapis i po display_clear
+#define STATE_CLEAR	0x100		//display_number_clear
+
+static uint16_t area_state[DISPLAY_AREA_MAX] = {
+	STATE_NONE, STATE_NONE, STATE_NONE, STATE_NONE, STATE_NONE
+};
+_Static_assert(DISPLAY_AREA_MAX == 5, "nieprawidłowa tablica area_state");
+
+//true, gdy obszar ma już ten stan, w przeciwnym razie zapamiętuje nowy
+static bool area_same(uint8_t area, uint16_t state)
+{
+	STATS_COUNT(calls[area])
+	if(area_state[area] == state) {
+		return true;
+	}
+	area_state[area] = state;
+	return false;
+}
+
+void display_begin(void)
 {
-	memset(&display, 0, sizeof(display));
+	batch++;
+}
+
+bool display_dirty(void)
+{
+	return frame_dirty;
+}
+
+void display_invalidate(void)
+{
+	frame_dirty = true;
 }
 
 /*
- * dla liczb większych niż maksymalna wyświetla --
- * dla liczb z ustawionym najstarszym bitem wyświetla E i numer błędu
+ * Publikacja pamięci ekranu bez blokowania przerwań
+ * Bez zmian od poprzedniej publikacji (frame_dirty) ramka nie jest przeliczana.
+ * pending zerowane jest przed przeliczeniem, więc przerwanie nie zamieni ramek w jego trakcie,
+ * a ramka tylna wyznaczona po wyzerowaniu jest na pewno nieczytana przez przerwanie.
+ * Niewyświetlona wcześniej ramka jest nadpisywana - wygrywa najnowsza.
  */
-void display_number(uint8_t val)
+void display_commit(void)
 {
-	if(val&0x80) {
-		memcpy_P( display.areas.tens, &tens_entities[TENS_ERROR], sizeof(display.areas.tens));
-		memcpy_P( display.areas.units, &units_entities[(val & 0x0f) % 11], sizeof(display.areas.units));
+	if(batch && --batch) {
+		return;
+	}
+	if(!frame_dirty) {
 		return;
 	}
-	if(val>MAX_NUMBER) {
-		memcpy_P( display.areas.tens, &tens_entities[TENS_DASH], sizeof(display.areas.tens));
-		memcpy_P( display.areas.units, &units_entities[UNITS_DASH], sizeof(display.areas.units));
+	frame_dirty = false;
+	adapt_restore();
+	render_busy = true;
+#ifdef DISPLAY_STATS
+	if(pending) {
+		stats.dropped++;
+	}
+	stats.renders++;
+#endif
+	pending = false;
+	frame_type *back = (scan_frame == &frames[0]) ? &frames[1] : &frames[0];
+	shown = display;
+#ifdef DISPLAY_LEVEL_BITS
+	for(uint8_t p = 0; p < LEVEL_PLANES; p++) {
+		shown_planes[p] = planes[p];
+	}
+#endif
+	scan_render(back);
+	render_busy = false;
+	if(timer_running()) {
+		pending = true;
+	} else {
+		//timer zatrzymany - przerwanie nie działa, zamiana od razu
+		scan_frame = back;
+		scan_counter = 0;
+		slot_rewind(back);
+		if(driver_on && FRAME_LEN(back)) {
+			frame_apply(back);
+			dwell_load(back);
+			timer_start();
+		}
+	}
+}
+
+void display_clear(void)
+{
+	display_begin();
+	for(uint8_t area = 0; area < DISPLAY_AREA_MAX; area++) {
+		area_state[area] = STATE_NONE;
+	}
+	area_set(SEG_ALL_MASK, 0);
+	display_commit();
+}
+
+void display_number(uint8_t val)
+{
+	if(area_same(DISPLAY_AREA_NUMBER, val)) {
 		return;
 	}
-	uint8_t tval = val / 10;
-	memcpy_P( display.areas.tens, &tens_entities[tval], sizeof(display.areas.tens));
-	tval = val % 10;
-	memcpy_P( display.areas.units, &units_entities[tval], sizeof(display.areas.units));
+	display_begin();
+	AREA_SET(NUMBER, number_glyph(val));
+	display_commit();
 }
 
 void display_number_clear(void)
 {
-	memset( display.areas.units, 0, sizeof(display.areas.units));
-	memset( display.areas.tens, 0, sizeof(display.areas.tens));
+	if(area_same(DISPLAY_AREA_NUMBER, STATE_CLEAR)) {
+		return;
+	}
+	display_begin();
+	AREA_SET(NUMBER, 0);
+	display_commit();
 }
 
 void display_power(bool show)
 {
-	memcpy_P( display.areas.power, power_entities[show], sizeof(display.areas.power));
+	if(area_same(DISPLAY_AREA_POWER, show)) {
+		return;
+	}
+	display_begin();
+	AREA_SET(POWER, power_entities[show]);
+	display_commit();
 }
 
 void display_percent(bool show)
 {
-	memcpy_P( display.areas.percent, percent_entities[show], sizeof(display.areas.percent));
+	if(area_same(DISPLAY_AREA_PERCENT, show)) {
+		return;
+	}
+	display_begin();
+	AREA_SET(PERCENT, percent_entities[show]);
+	display_commit();
 }
 
 void display_droplet(uint8_t level)
 {
 	level %= DROP_ENT_MAX;
-	memcpy_P( display.areas.droplet, drop_entities[level], sizeof(display.areas.droplet));
+	if(area_same(DISPLAY_AREA_DROP, level)) {
+		return;
+	}
+	display_begin();
+	AREA_SET(DROP, drop_entities[level]);
+	display_commit();
 }
 
 void display_filling(uint8_t level)
 {
 	level %= FILL_ENT_MAX;
-	memcpy_P( display.areas.fill, fill_entities[level], sizeof(display.areas.fill));
+	if(area_same(DISPLAY_AREA_FILL, level)) {
+		return;
+	}
+	display_begin();
+	AREA_SET(FILL, fill_entities[level]);
+	display_commit();
+}
+
+#ifdef DISPLAY_LEVEL_BITS
+/*
+ * segment 1-25 (SEG_n), poziom powyżej maksymalnego jest obcinany
+ * zmiana jasności nie zapala segmentu - o tym decydują setery obszarów
+ */
+void display_segment_level(uint8_t segment, uint8_t level)
+{
+	if(!segment || segment > SEG_MAX) {
+		return;
+	}
+#if LEVEL_PLANES < 8
+	if(level > LEVEL_MAX) {
+		level = LEVEL_MAX;
+	}
+#endif
+	screen_type bit = (screen_type)1 << (segment - 1);
+	display_begin();
+	for(uint8_t p = 0; p < LEVEL_PLANES; p++, level >>= 1) {
+		screen_type plane = (level & 1) ? (planes[p] | bit) : (planes[p] & ~bit);
+		if(plane != planes[p]) {
+			planes[p] = plane;
+			frame_dirty = true;
+		}
+	}
+	display_commit();
+}
+#endif
+
+/*
+ * Granica ramki - zamiana na ramkę opublikowaną przez display_commit
+ * Wywoływana z przerwania po ostatnim slocie ramki.
+ */
+static inline frame_type *frame_next(frame_type *frame)
+{
+	if(pending) {
+		frame = (frame == &frames[0]) ? &frames[1] : &frames[0];
+		scan_frame = frame;
+		pending = false;
+#ifdef DISPLAY_SKIP_BLANK
+		if(!frame->len) {
+			timer_stop();
+			lines_off();
+			fade_finish();
+		}
+#endif
+	}
+	STATS_COUNT(frames)
+#ifdef DISPLAY_LEVEL_BITS
+	if(++scan_plane >= LEVEL_PLANES) {
+		scan_plane = 0;
+	}
+#endif
+	for(uint8_t ticks = frame_tick(frame); ticks; ticks--) {
+		fade_next();
+		anim_next();
+		blink_next();
+		tick_next();
+		adapt_next();
+	}
+	frame_apply(frame);
+	slot_rewind(frame);
+	return frame;
+}
+
+/*
+ * Granica ramki z przerwania skanowania
+ * DISPLAY_SCAN_PRIORITY - przy odblokowanych przerwaniach, z wyjątkiem przepełnienia
+ * (ponowne wejście w frame_next), maska przywracana bez zmian
+ */
+static inline void frame_boundary(frame_type *frame)
+{
+#ifdef DISPLAY_SCAN_PRIORITY
+	uint8_t mask = TIMSK0;
+	TIMSK0 = mask & ~_BV(TOIE0);
+	DWELL_LOADED_CLEAR
+	sei();
+	frame_next(frame);
+	cli();
+	TIMSK0 = mask;
+#else
+	frame_next(frame);
+#endif
+}
+
+#ifdef DISPLAY_ISR_ASM
+
+//granica ramki dla wersji w asemblerze
+#define scan_frame_vect __vector_scan_frame
+
+/*
+ * włączenie cyfr - wersja w asemblerze
+ * Wskaźnik slotu w GPIOR1:GPIOR2, slot zawiera gotowe wartości, więc nie ma read-modify-write
+ * ani instrukcji zmieniających SREG - nie trzeba go zachowywać.
+ * Anoda ustawiana jest przez wpis do rejestru PIN (przełączenie), linie muszą być LOW na
+ * początku slotu, co zapewnia wygaszenie w TIMER0_COMPB_vect (OCR0B <= OCR0A).
+ *
+ * Cykle - szacunek z tabeli czasów instrukcji, niezmierzony (bench/run.sh DISPLAY_ISR_ASM);
+ * bez DEBUG_ISR_TEST, slot inny niż ostatni:
+ *   reakcja na przerwanie + jmp z wektora    7
+ *   push x3                                  6
+ *   in x2                                    2
+ *   ld/out kierunek, ld/out anoda            6
+ *   ld znacznik, sbrc (skok)                 4
+ *   out x2                                   2
+ *   pop x3                                   6
+ *   reti                                     4
+ *   razem                                   37
+ *   (+1 przy DISPLAY_BLANK_TOGGLE - zapis anody do GPIOR0)
+ * Szacunkowo 1750 Hz x 37 = 64750 cykli/s, przy 8 MHz ok. 0.8% (wersja w C ok. 2% z pomiaru
+ * oscyloskopem), w trybie anodowym 420 Hz x 37 - ok. 0.2%. Ostatni slot ramki przechodzi do scan_frame_vect (C, raz na ramkę).
+ */
+ISR(TIMER0_OVF_vect, ISR_NAKED)
+{
+	asm volatile(
+		TEST_PIN_0_HIGH_ASM
+		"push r30"					"\n\t"
+		"push r31"					"\n\t"
+		"push r24"					"\n\t"
+		"in r30, %[ptr_lo]"			"\n\t"
+		"in r31, %[ptr_hi]"			"\n\t"
+		"ld r24, Z+"				"\n\t"	//kierunek
+		"out %[dir], r24"			"\n\t"
+		"ld r24, Z+"				"\n\t"	//anoda
+		"out %[pin], r24"			"\n\t"
+		BLANK_SET_ASM
+		"ld r24, Z+"				"\n\t"	//znacznik ostatniego slotu
+		"sbrc r24, 0"				"\n\t"
+		"rjmp 1f"					"\n\t"
+		"out %[ptr_lo], r30"		"\n\t"
+		"out %[ptr_hi], r31"		"\n\t"
+		"pop r24"					"\n\t"
+		"pop r31"					"\n\t"
+		"pop r30"					"\n\t"
+		TEST_PIN_0_LOW_ASM
+		"reti"						"\n\t"
+	"1:"							"\n\t"
+		"pop r24"					"\n\t"
+		"pop r31"					"\n\t"
+		"pop r30"					"\n\t"
+		"%~jmp " STR(scan_frame_vect)	"\n\t"
+		:
+		: [ptr_lo] "I" (_SFR_IO_ADDR(GPIOR1)),
+		  [ptr_hi] "I" (_SFR_IO_ADDR(GPIOR2)),
+		  [dir] "I" (_SFR_IO_ADDR(O_DIR)),
+		  [pin] "I" (_SFR_IO_ADDR(O_PIN)),
+		  [port] "I" (_SFR_IO_ADDR(O_PORT)),
+		  [blank] "I" (_SFR_IO_ADDR(GPIOR0))
+	);
+}
+
+//granica ramki dla wersji w asemblerze - zwykła procedura przerwania w C, kończy się reti
+ISR(scan_frame_vect)
+{
+	frame_boundary(scan_frame);
+
+	TEST_PIN_0_LOW
+
+	frame_render();
 }
 
+#else
+
 //włączenie cyfr
 ISR(TIMER0_OVF_vect)
 {
-	static uint8_t counter;
+	frame_type *frame = scan_frame;
+	uint8_t counter = scan_counter;
+	segment_type seg;
 	uint8_t tmp;
 
+	STATS_SLOT_ENTRY
 	TEST_PIN_0_HIGH
 
+	seg = slot_fetch(frame, counter);
 	tmp = O_DIR & DISPLAY_LINES_NEG_MASK;
-	O_DIR = display.buffer[counter].active_mask | tmp;
+	O_DIR = seg.active_mask | tmp;
 	tmp = O_PORT & DISPLAY_LINES_NEG_MASK;
-	O_PORT = display.buffer[counter].anode_mask | tmp;
-	if(++counter>=SEG_MAX) {
+	O_PORT = seg.anode_mask | tmp;
+	BLANK_SET(seg.anode_mask)
+	if(++counter>=FRAME_LEN(frame)) {
 		counter = 0;
+		frame_boundary(frame);
 	}
+	scan_counter = counter;
+	dwell_next(counter);
 
 	TEST_PIN_0_LOW
+	STATS_SLOT_EXIT
+
+	if(!counter) {
+		frame_render();
+	}
+}
+
+#endif
+
+#ifdef DISPLAY_BLANK_TOGGLE
+
+/*
+ * sterowanie jasnością - wyłączenie jednym zapisem
+ * Zapis maski anody do rejestru PIN przełącza HIGH->LOW tylko linie świecące, pozostałe piny
+ * portu nie są dotykane. Zerowanie BLANK_MASK czyni wygaszenie idempotentnym (np. gdy
+ * opóźnione przepełnienie i compare obsługiwane są w kolejności COMPB, OVF).
+ * Nie zmienia SREG.
+ *
+ * Cykle - szacunek z tabeli czasów instrukcji, niezmierzony (bench/run.sh DISPLAY_BLANK_TOGGLE);
+ * bez DEBUG_ISR_TEST:
+ *   reakcja na przerwanie + jmp z wektora    7
+ *   push, in                                 3
+ *   out PIN - wszystkie linie LOW            1   -> ciemno po 11 cyklach od compare match
+ *   ldi, out                                 2
+ *   pop                                      2
+ *   reti                                     4
+ *   razem                                   19
+ * Wersja z sześcioma cbi: 23 cykle, linia A gaśnie po 9, linia F po 19 cyklach - segmenty
+ * z anodą F świecą o 10 cykli dłużej, co przy małym OCR0B (1 takt timera = 64 cykle)
+ * daje wyraźną różnicę jasności.
+ * DISPLAY_SLOT_DWELL - po wygaszeniu przepisanie TOP i OCR0B następnego slotu, +6 cykli
+ * (+2 przy DISPLAY_SCAN_PRIORITY).
+ */
+#ifdef DISPLAY_SLOT_DWELL
+#ifdef DISPLAY_SCAN_PRIORITY
+#define DWELL_LOADED_ASM \
+		"ldi r24, 1"				"\n\t" \
+		"sts %[loaded], r24"		"\n\t"
+#define DWELL_LOADED_OPERAND , [loaded] "i" (&dwell_loaded)
+#else
+#define DWELL_LOADED_ASM
+#define DWELL_LOADED_OPERAND
+#endif
+#define DWELL_COPY_ASM \
+		"lds r24, %[next_top]"		"\n\t" \
+		"out %[ocra], r24"			"\n\t" \
+		"lds r24, %[next_ocr]"		"\n\t" \
+		"out %[ocrb], r24"			"\n\t" \
+		DWELL_LOADED_ASM
+#define DWELL_COPY_OPERANDS , \
+		  [next_top] "i" (&dwell_next_top), \
+		  [next_ocr] "i" (&dwell_next_ocr), \
+		  [ocra] "I" (_SFR_IO_ADDR(OCR0A)), \
+		  [ocrb] "I" (_SFR_IO_ADDR(OCR0B)) \
+		  DWELL_LOADED_OPERAND
+#else
+#define DWELL_COPY_ASM
+#define DWELL_COPY_OPERANDS
+#endif
+
+ISR(TIMER0_COMPB_vect, ISR_NAKED)
+{
+	asm volatile(
+		TEST_PIN_1_HIGH_ASM
+		"push r24"					"\n\t"
+		"in r24, %[blank]"			"\n\t"
+		"out %[pin], r24"			"\n\t"
+		"ldi r24, 0"				"\n\t"
+		"out %[blank], r24"			"\n\t"
+		DWELL_COPY_ASM
+		"pop r24"					"\n\t"
+		TEST_PIN_1_LOW_ASM
+		"reti"						"\n\t"
+		:
+		: [pin] "I" (_SFR_IO_ADDR(O_PIN)),
+		  [port] "I" (_SFR_IO_ADDR(O_PORT)),
+		  [blank] "I" (_SFR_IO_ADDR(GPIOR0))
+		  DWELL_COPY_OPERANDS
+	);
+}
+
+#elif defined(DISPLAY_STATS) || defined(DISPLAY_SLOT_DWELL)
+
+//sterowanie jasnością - wyłączenie z pomiarem albo z przepisaniem czasu następnego slotu
+//(DISPLAY_SLOT_DWELL), zwykła procedura przerwania - linie gasną kilkanaście cykli później
+//niż w wersji ISR_NAKED
+ISR(TIMER0_COMPB_vect)
+{
+#ifdef DISPLAY_STATS
+	uint8_t entry = TCNT0;
+#endif
+
+	DISPLAY_LINES(LINE_PORT_OFF, 0)
+	dwell_copy();
+
+#ifdef DISPLAY_STATS
+	stats_blank(entry);
+#endif
 }
 
+#else
+
 //sterowanie jasnością - wyłączenie
 ISR(TIMER0_COMPB_vect, ISR_NAKED)
 {
 	TEST_PIN_1_HIGH
 
-	O_PORT &= ~LINE_A;
-	O_PORT &= ~LINE_B;
-	O_PORT &= ~LINE_C;
-	O_PORT &= ~LINE_D;
-	O_PORT &= ~LINE_E;
-	O_PORT &= ~LINE_F;
+	DISPLAY_LINES(LINE_PORT_OFF, 0)
 
 	TEST_PIN_1_LOW
 
-	asm volatile( "reti" );
+	reti();
 }
 
+#endif
 
-//50Hz x 25 segmentów = 1250 Hz
-//16MHz/1250Hz -> preskaler 64 OCRA 200
-//8MHz/1250Hz -> preskaler 64 OCRA 100
-//
-//70Hz x 25 segmentów = 1750 Hz
-//16MHz/1750Hz -> preskaler 64 OCRA 142
-//8MHz/1750Hz -> preskaler 64 OCRA 71
-#define PRESKALER_MASK (_BV(CS01) | _BV(CS00))
-#define TIMER_MAX 72
 
 void display_init(void)
 {
@@ -371,50 +2208,235 @@ void display_init(void)
 	TCCR0A = _BV(WGM00) | _BV(WGM01);
 	TCCR0B = _BV(WGM02);
 	//maksymalna wartość licznika
-	OCR0A = TIMER_MAX;
+	OCR0A = timer_top;
 	//początkowo jasność wyświetlania ==max
-	OCR0B = TIMER_MAX;
+	OCR0B = timer_top;
+#ifdef DISPLAY_LEVEL_BITS
+	level_timing(brightness_fix);
+#endif
 	TIMSK0 = _BV(OCIE0B) | _BV(TOIE0); //przerwanie compare match i przepełnienie
-	//lec goł
-	TCCR0B |= PRESKALER_MASK;
+	adapt_plan(DISPLAY_REFRESH_HZ);
+	//ramka przednia z bieżącą pamięcią ekranu i kierunkiem pinów testowych, timer jeszcze stoi
+	display_begin();
+	display_commit();
+	driver_on = true;
+	//lec goł, pusta ramka przy DISPLAY_SKIP_BLANK - timer wystartuje po zapaleniu czegokolwiek
+	if(FRAME_LEN(scan_frame)) {
+		frame_apply(scan_frame);
+		dwell_load(scan_frame);
+		TCCR0B |= timer_mask;
+	}
 }
 
 void display_driver_on(void)
 {
-	//wyczyszczenie ewentualnie wiszących przerwań
-	TIFR0 = _BV(OCF0B) | _BV(TOV0);
+	driver_on = true;
 	//włączenie przerwań
 //	TIMSK0 = _BV(OCIE0B) | _BV(TOIE0);
-	//ustawienie preskalera
-	TCCR0B |= PRESKALER_MASK;
+	//pusta ramka przy DISPLAY_SKIP_BLANK - timer wystartuje po zapaleniu czegokolwiek
+	if(FRAME_LEN(scan_frame)) {
+		timer_start();
+	}
 }
 
 void display_driver_off(void)
 {
+	driver_on = false;
 	//zatrzymanie timera i wyłączenie przerwań
-	TCCR0B &= ~PRESKALER_MASK;
+	timer_stop();
+	fade_finish();
 //	TIMSK0 &= ~(_BV(OCIE0A) | _BV(TOIE0));
 
 	//wyłączenie wyświetlania
-	O_PORT &= ~LINE_A;
-	O_PORT &= ~LINE_B;
-	O_PORT &= ~LINE_C;
-	O_PORT &= ~LINE_D;
-	O_PORT &= ~LINE_E;
-	O_PORT &= ~LINE_F;
-	O_DIR &= ~LINE_A;
-	O_DIR &= ~LINE_B;
-	O_DIR &= ~LINE_C;
-	O_DIR &= ~LINE_D;
-	O_DIR &= ~LINE_E;
-	O_DIR &= ~LINE_F;
+	lines_off();
 }
 
 void display_brigthness(uint8_t brightness)
 {
 	if(brightness > 100) {
-		OCR0B = TIMER_MAX;
-	} else {
-		OCR0B = brightness * TIMER_MAX / 100;
+		brightness = 100;
+	}
+	display_luminance((uint16_t)brightness * 255 / 100);
+}
+
+void display_luminance(uint8_t level)
+{
+	uint16_t fix = gamma_ocr[level];
+
+	//przerywa display_fade_to
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		fading = false;
+		fade_level = (uint16_t)level << 8;
+		brightness_fix = fix;
+	}
+#if defined(DISPLAY_SKIP_NORMALIZE)
+	//OCR0B przeliczane przez przerwanie co ramkę
+#elif defined(DISPLAY_LEVEL_BITS)
+	//przerwanie wpisuje OCR0B płaszczyzny na granicy ramki
+	level_timing(fix);
+#else
+	//dithering od następnej ramki, do tego czasu (lub przy zatrzymanym timerze) część całkowita
+	SLOT_OCR_SET((((uint32_t)fix * refresh_k) >> 8) >> GAMMA_FRAC)
+#endif
+}
+
+void display_set_refresh(uint8_t hz)
+{
+	adapt_plan(hz);
+	refresh_set(hz);
+	//ramka z nowym czasem i TOP w trybie pomijania slotów
+	display_invalidate();
+	display_begin();
+	display_commit();
+}
+
+void display_fade_to(uint8_t target, uint16_t duration_ms)
+{
+	uint16_t frames = (uint32_t)duration_ms * (F_CPU / 1000) / FRAME_CYCLES;
+	uint16_t level;
+
+	if(!frames || !timer_running()) {
+		display_luminance(target);
+		return;
+	}
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		fading = false;
+		level = fade_level;
+	}
+	//przy jednej ramce krok nie jest używany
+	int16_t step = (frames > 1) ? (int16_t)((((int32_t)target << 8) - level) / frames) : 0;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		fade_target = target;
+		fade_step = step;
+		fade_frames = frames;
+		fading = true;
+	}
+}
+
+bool display_fading(void)
+{
+	return fading;
+}
+
+void display_animate(uint8_t area, const __flash display_anim_type *anim)
+{
+	if(area >= DISPLAY_AREA_MAX) {
+		return;
+	}
+	screen_type mask = area_masks[area];
+	display_begin();
+	display_invalidate();
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		anim_channel_type *ch = &anim_channels[area];
+		if(anim && anim->len) {
+			ch->anim = anim;
+			ch->key = 0xff;
+			ch->loops = anim->loops;
+			anim_key(area);
+		} else {
+			ch->anim = NULL;
+			anim_mask &= ~mask;
+			anim_bits &= ~mask;
+		}
 	}
+	display_commit();
 }
+
+void display_blink(uint8_t area, uint16_t period_ms, uint8_t duty, uint8_t phase)
+{
+	if(area >= DISPLAY_AREA_MAX) {
+		return;
+	}
+	screen_type mask = area_masks[area];
+	uint16_t period = (uint32_t)period_ms * (F_CPU / 1000) / FRAME_CYCLES;
+	uint16_t on = 0, off = 0, pos = 0;
+	if(period) {
+		if(duty > 100) {
+			duty = 100;
+		}
+		if(phase > 100) {
+			phase = 100;
+		}
+		on = (uint32_t)period * duty / 100;
+		off = period - on;
+		pos = (uint32_t)period * phase / 100;
+	}
+	display_begin();
+	display_invalidate();
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		blink_channel_type *ch = &blink_channels[area];
+		ch->on = on;
+		ch->off = off;
+		if(on && off) {
+			pos = (blink_clock + pos) % period;
+			ch->lit = pos < on;
+			ch->left = ch->lit ? on - pos : period - pos;
+			blink_mask |= mask;
+		} else {
+			//0% i 100% bez migania
+			ch->lit = on;
+			blink_mask &= ~mask;
+		}
+		if(ch->lit || !period) {
+			blink_off &= ~mask;
+		} else {
+			blink_off |= mask;
+		}
+	}
+	display_commit();
+}
+
+bool display_driver_running(void)
+{
+	return driver_on;
+}
+
+bool display_idle(void)
+{
+	bool idle;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		idle = !shown && !anim_mask && !blink_mask && !fading;
+	}
+	return idle;
+}
+
+bool display_animating(uint8_t area)
+{
+	bool active = false;
+
+	if(area < DISPLAY_AREA_MAX) {
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			active = anim_channels[area].anim != NULL;
+		}
+	}
+	return active;
+}
+
+#ifdef DISPLAY_STATS
+static void stats_read(const stats_time_type *time, uint16_t *min, uint16_t *max, uint16_t *avg)
+{
+	*min = time->count ? time->min : 0;
+	*max = time->max;
+	*avg = time->count ? time->sum / time->count : 0;
+}
+
+void display_get_stats(display_stats_type *out)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		*out = stats;
+		out->tick_cycles = timer_div;
+		stats_read(&stats_ovf, &out->ovf_min, &out->ovf_max, &out->ovf_avg);
+		stats_read(&stats_compb, &out->compb_min, &out->compb_max, &out->compb_avg);
+	}
+}
+
+void display_reset_stats(void)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		stats = (display_stats_type){ 0 };
+		stats_ovf = (stats_time_type)STATS_TIME_INIT;
+		stats_compb = (stats_time_type)STATS_TIME_INIT;
+	}
+}
+#endif
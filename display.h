@@ -16,6 +16,7 @@
  */
 #define O_PORT	PORTD
 #define O_DIR	DDRD
+#define O_PIN	PIND
 /*
  * Przypisanie pinów mikrokontrolera do pinów wyświetlacza (6 wyprowadzeń)
  * Oznakowanie pinów wyświetlacza: A-F od dołu do góry, przy właściwej orientacji kropli
@@ -27,10 +28,138 @@
 #define E_PIN 4
 #define F_PIN 5
 
+/*
+ * Lista linii wyświetlacza, dla każdej linii x wymagane x_PIN na porcie O_PORT (2-8 linii).
+ * Segmenty (anoda, katoda) przypisuje do linii mapa SEGMENT_MAP w display.c - przy N liniach
+ * do N*(N-1) segmentów, nie więcej niż 32. Przerwanie przełącza wszystkie linie zapisem
+ * jednego portu, więc linie nie mogą być rozłożone na kilka portów.
+ */
+#define DISPLAY_LINES(X, p) X(p, A) X(p, B) X(p, C) X(p, D) X(p, E) X(p, F)
+
 //piny inne niż powyżej
 #define TEST_PIN_0 6
 #define TEST_PIN_1 7
 
+/*
+ * Tryb skanowania
+ * Domyślnie każdy z 25 segmentów ma własny slot czasowy (duty cycle 1:25).
+ * DISPLAY_SCAN_ANODE - segmenty o wspólnej anodzie zapalane są w jednym slocie, jedna linia
+ * HIGH i kilka katod LOW, 6 slotów na ramkę (duty cycle 1:6). Przy tej samej jasności
+ * pozwala obniżyć częstotliwość przerwań ok. 4 razy.
+ * DISPLAY_SLOT_SEGS - ograniczenie prądu linii anody: maksymalna liczba segmentów
+ * zapalanych jednocześnie w slocie (od 2 do liczby segmentów najliczniejszej anody, tu 5),
+ * grupy liczniejsze dzielone są na kolejne sloty
+ */
+//#define DISPLAY_SCAN_ANODE
+//#define DISPLAY_SLOT_SEGS 5
+
+/*
+ * DISPLAY_SKIP_BLANK - przerwanie odwiedza tylko zapalone sloty, czas pustych przypada
+ * zapalonym segmentom (jaśniejsze przy mniejszej liczbie zapalonych). Gdy nic nie świeci,
+ * timer wyświetlacza jest zatrzymywany i wznawiany przez pierwszy zapalający setter.
+ * DISPLAY_SKIP_NORMALIZE - normalizacja czasu ramki: okres slotu i OCR0B dobierane do liczby
+ * zapalonych slotów tak, że jasność segmentu jest stała, a przerwań jest mniej
+ */
+//#define DISPLAY_SKIP_BLANK
+//#define DISPLAY_SKIP_NORMALIZE
+
+/*
+ * DISPLAY_ISR_ASM - przerwanie skanowania w asemblerze (szacunkowo ok. 0.8% CPU przy 1750 Hz
+ * i 8 MHz, z liczby cykli instrukcji - niezmierzone, nie było jeszcze asemblowane avr-gcc).
+ * Zajmuje rejestry GPIOR1 i GPIOR2 (wskaźnik slotu). Wymaga przełączania pinów zapisem do
+ * rejestru PIN (m48/88/168/328). Kierunek pozostałych pinów O_PORT zapamiętywany jest przy
+ * display_commit - po jego zmianie w trakcie pracy wyświetlacza trzeba wywołać
+ * display_invalidate/display_commit.
+ */
+//#define DISPLAY_ISR_ASM
+
+/*
+ * DISPLAY_BLANK_TOGGLE - wygaszanie (koniec czasu świecenia w TIMER0_COMPB_vect) jednym
+ * zapisem do rejestru PIN zamiast sześciu cbi: wszystkie linie gasną jednocześnie, 11 cykli
+ * po compare match zamiast od 9 (linia A) do 19 (linia F), co poprawia liniowość jasności
+ * przy małych wartościach. Liczby cykli szacowane z czasów instrukcji, niezmierzone
+ * (bench/run.sh DISPLAY_BLANK_TOGGLE). Zajmuje rejestr GPIOR0, wymaga przełączania pinów
+ * zapisem do PIN (m48/88/168/328).
+ */
+//#define DISPLAY_BLANK_TOGGLE
+
+/*
+ * DISPLAY_LEVEL_BITS - indywidualna jasność segmentów 4-8 bitów, modulacja kodowa (BCM):
+ * kolejne ramki wyświetlają kolejne płaszczyzny bitowe z czasem świecenia (OCR0B) ~ 2^bit,
+ * koszt przerwania nie zależy od liczby poziomów. Cykl trwa DISPLAY_LEVEL_BITS ramek,
+ * przy 70 Hz i 4 bitach 17.5 Hz - warto podnieść częstotliwość ramek. Najwyższy poziom daje
+ * ok. 2/DISPLAY_LEVEL_BITS jasności bez modulacji, najmłodsze płaszczyzny przy 8 bitach
+ * tracą rozdzielczość (OCR0B < 1). Nie współpracuje z DISPLAY_SKIP_BLANK.
+ */
+//#define DISPLAY_LEVEL_BITS 4
+
+/*
+ * DISPLAY_GAMMA - wykładnik korekcji jasności (domyślnie 2.2), 1.0 - skala liniowa
+ */
+//#define DISPLAY_GAMMA 2.2
+
+/*
+ * DISPLAY_REFRESH_HZ - nominalna częstotliwość ramek (domyślnie 70). Preskaler i TOP timera
+ * dobiera kompilator z F_CPU i liczby slotów skanowania; nieosiągalna wartość zatrzymuje
+ * kompilację. Jasność i czasy (display_fade_to, animacje, miganie) nie zależą od
+ * bieżącego odświeżania ustawionego przez display_set_refresh.
+ */
+//#define DISPLAY_REFRESH_HZ 70
+
+/*
+ * DISPLAY_ADAPTIVE_HZ - adaptacyjne odświeżanie: przy statycznej treści (bez display_commit,
+ * animacji, migania i display_fade_to przez DISPLAY_ADAPTIVE_MS, domyślnie 1000) częstotliwość
+ * ramek schodzi stopniowo do DISPLAY_ADAPTIVE_HZ - mniej przerwań i przełączeń pinów.
+ * Dowolny display_commit przywraca od razu częstotliwość bazową. Granica migotania zależy od
+ * wypełnienia: skanowanie segmentami (krótkie impulsy) ok. 50 Hz, tryb anodowy ok. 40 Hz;
+ * przy DISPLAY_LEVEL_BITS cykl płaszczyzn jest DISPLAY_LEVEL_BITS razy wolniejszy.
+ */
+//#define DISPLAY_ADAPTIVE_HZ 50
+//#define DISPLAY_ADAPTIVE_MS 1000
+
+/*
+ * DISPLAY_TICK_MS - tick aplikacji (np. timerów programowych) z przerwania wyświetlacza
+ * zamiast osobnego timera: display_tick() wywoływana co DISPLAY_TICK_MS, nie mniej niż czas
+ * ramki (ok. 15 ms). Zegarem jest skanowanie, więc timer wyświetlacza nie jest zatrzymywany
+ * przy pustym ekranie (DISPLAY_SKIP_BLANK); po display_driver_off tick stoi.
+ */
+//#define DISPLAY_TICK_MS 16
+
+/*
+ * DISPLAY_STATS - liczniki pracy wyświetlacza odczytywane przez display_get_stats, zamiast
+ * pinów DEBUG_ISR_TEST i oscyloskopu. Czas przerwań mierzony odczytem TCNT0 na wejściu
+ * i wyjściu - rozdzielczość to takt timera (64 cykle przy 8 MHz i 70 Hz), średnia z wielu
+ * slotów jest dokładniejsza. Slot spóźniony - start przerwania później niż
+ * DISPLAY_STATS_LATE cykli (domyślnie 128) po przepełnieniu. Narzut ok. 150 cykli na slot.
+ * Przerwania w asemblerze (DISPLAY_ISR_ASM, DISPLAY_BLANK_TOGGLE) nie są mierzone.
+ */
+//#define DISPLAY_STATS
+//#define DISPLAY_STATS_LATE 128
+//#define DISPLAY_STATS_BINS 8
+
+/*
+ * DISPLAY_SCAN_PRIORITY - stały czas świecenia przy obciążeniu przerwaniami. Przeliczenia
+ * na granicy ramki (jasność, animacje, miganie, tick) idą przy odblokowanych przerwaniach
+ * i zablokowanym przepełnieniu timera - wygaszanie ostatniego slotu (TIMER0_COMPB_vect)
+ * nie czeka na nie, więc przy małej jasności ostatni segment ramki nie świeci dłużej.
+ * Przerwania aplikacji powinny odblokowywać przerwania na wejściu (ISR_NOBLOCK, jak
+ * TIMER2_OVF_vect w main.c), żeby nie opóźniały startu slotu, i nie mogą wywoływać funkcji
+ * wyświetlacza. Rozkład opóźnień startu slotu - DISPLAY_STATS, latency_hist.
+ */
+//#define DISPLAY_SCAN_PRIORITY
+
+/*
+ * DISPLAY_SLOT_DWELL - czas slotu zależny od segmentu: wyrównanie jasności diod o różnej
+ * sprawności (kolory wypełnienia kropli, cyfry) bez obniżania wypełnienia jaśniejszych.
+ * Względne czasy segmentów - SEGMENT_DWELL w display.c albo wagi obszarów (DWELL_FILL itd.)
+ * z opcji kompilatora, kalibrowane raz; kompilator przelicza je tak, że ramka trwa tyle
+ * co bez nich. Przerwanie skanowania liczy OCR0A
+ * i OCR0B następnego slotu, a wpisuje je wygaszenie (w C, chyba że DISPLAY_BLANK_TOGGLE);
+ * najdłuższe świecenie slotu krótsze o czas tego wpisu. Ramka przeliczana jest do RAM.
+ * Tylko skanowanie segmentami, bez DISPLAY_SKIP_NORMALIZE i DISPLAY_ISR_ASM.
+ */
+//#define DISPLAY_SLOT_DWELL
+
 //inicjuje hardware procesora tj. timer 0 i odpowiednie przerwania
 extern void display_init(void);
 //zatrzymuje timer wyświetlacza i wygasza segmenty, nie modyfikuje bufora
@@ -39,8 +168,39 @@ extern void display_driver_off(void);
 //wznawia pracę timera
 //funkcja wywoływana po obudzeniu urządzenia z głebokiego uśpienia
 extern void display_driver_on(void);
+//true po display_init i display_driver_on, false po display_driver_off
+extern bool display_driver_running(void);
+#ifdef DISPLAY_TICK_MS
+//definiowana przez aplikację, wywoływana z przerwania wyświetlacza co DISPLAY_TICK_MS
+extern void display_tick(void);
+#endif
+//true, gdy ekran jest pusty i nie działa animacja, miganie ani zmiana jasności -
+//wyświetlacz można wyłączyć (display_driver_off) na czas głębokiego uśpienia
+extern bool display_idle(void);
 //ustawia poziom jasności w zakresie 0-100
 extern void display_brigthness(uint8_t brightness);
+//jasność postrzegana 0-255 z korekcją gamma (DISPLAY_GAMMA)
+extern void display_luminance(uint8_t level);
+//płynna zmiana jasności postrzeganej do target w czasie duration_ms, realizowana przez
+//przerwanie wyświetlacza na granicach ramek; przerywana przez display_luminance/display_brigthness
+extern void display_fade_to(uint8_t target, uint16_t duration_ms);
+//true do zakończenia display_fade_to
+extern bool display_fading(void);
+//zmienia częstotliwość ramek w czasie pracy, np. niska przy statycznej treści mniej obciąża
+//procesor; ograniczana do możliwości timera i czasu przerwań; przy DISPLAY_ADAPTIVE_HZ bazowa
+extern void display_set_refresh(uint8_t hz);
+
+//grupowanie zmian: setery wywołane między display_begin a display_commit pojawią się na
+//wyświetlaczu razem, w jednej ramce; pary mogą być zagnieżdżone
+//każdy seter bez display_begin publikuje swoją zmianę od razu
+extern void display_begin(void);
+extern void display_commit(void);
+//true, gdy pamięć ekranu zmieniła się od ostatniego display_commit; setery wywołane z tym
+//samym stanem obszaru nie zmieniają pamięci i kończą się od razu, a display_commit bez zmian
+//nie przelicza ramki
+extern bool display_dirty(void);
+//wymusza przeliczenie ramki przy najbliższym display_commit
+extern void display_invalidate(void);
 
 //wygaszenie wskaźników na wyświetlaczu
 extern void display_clear(void);
@@ -103,5 +263,92 @@ enum {
 };
 extern void display_filling(uint8_t level);
 
+/*
+ * Animacje odtwarzane przez przerwanie wyświetlacza
+ * Klatka to stan obszaru (argument jak dla setera obszaru: liczba, true/false, DROP_x,
+ * FILL_x) i czas jej wyświetlania. Sekwencja klatek i opis animacji leżą w pamięci programu.
+ * Animacja przykrywa obszar, setery zmieniają pamięć ekranu pod nią - po zakończeniu
+ * (ostatnie powtórzenie albo display_animate(area, NULL)) obszar wraca do jej zawartości.
+ */
+enum {
+	DISPLAY_AREA_NUMBER,
+	DISPLAY_AREA_PERCENT,
+	DISPLAY_AREA_POWER,
+	DISPLAY_AREA_FILL,
+	DISPLAY_AREA_DROP,
+	DISPLAY_AREA_MAX,
+};
+
+typedef struct {
+	uint8_t state;		//stan obszaru
+	uint8_t time;		//czas klatki x 10 ms (DISPLAY_ANIM_MS)
+} display_key_type;
+
+typedef struct {
+	const __flash display_key_type *keys;
+	uint8_t len;		//liczba klatek
+	uint8_t loops;		//liczba odtworzeń, 0 - bez końca
+} display_anim_type;
+
+#define DISPLAY_ANIM_MS(ms) ((ms) / 10)
+//opis animacji z tablicy klatek
+#define DISPLAY_ANIM(keys, loops) { keys, sizeof(keys) / sizeof((keys)[0]), loops }
+
+//uruchamia animację obszaru od pierwszej klatki, NULL zatrzymuje
+extern void display_animate(uint8_t area, const __flash display_anim_type *anim);
+//true do zakończenia animacji obszaru
+extern bool display_animating(uint8_t area);
+
+//miganie obszaru: okres w ms, wypełnienie i przesunięcie fazy w % okresu, realizowane przez
+//przerwanie maskowaniem na granicy ramki; period_ms == 0 wyłącza miganie
+//przesunięcie liczone od wspólnego licznika ramek - obszary o tych samych parametrach
+//migają synchronicznie; działa także na obszarach z animacją
+extern void display_blink(uint8_t area, uint16_t period_ms, uint8_t duty, uint8_t phase);
+
+#ifdef DISPLAY_STATS
+#ifndef DISPLAY_STATS_BINS
+#define DISPLAY_STATS_BINS 8
+#endif
+
+//czasy w cyklach procesora, zliczane od display_init albo display_reset_stats
+typedef struct {
+	uint32_t frames;		//ramki
+	uint32_t slots;			//przerwania skanowania (TIMER0_OVF_vect)
+	uint32_t late;			//sloty spóźnione (DISPLAY_STATS_LATE)
+	uint16_t overruns;		//przerwania skanowania dłuższe niż slot
+	uint16_t dropped;		//ramki opublikowane i nadpisane przed wyświetleniem
+	uint16_t renders;		//przeliczenia ramki przez display_commit
+	uint16_t calls[DISPLAY_AREA_MAX];	//wywołania seterów obszarów
+	uint16_t ovf_min;		//czas TIMER0_OVF_vect
+	uint16_t ovf_max;
+	uint16_t ovf_avg;
+	uint16_t compb_min;		//czas TIMER0_COMPB_vect
+	uint16_t compb_max;
+	uint16_t compb_avg;
+	uint16_t latency_max;	//najdłuższe opóźnienie startu slotu
+	//histogram opóźnień startu slotu w taktach timera (TCNT0 na wejściu, TOP jako 0),
+	//ostatni przedział zbiera dłuższe
+	uint16_t latency_hist[DISPLAY_STATS_BINS];
+	uint16_t tick_cycles;	//cykle na takt timera przy bieżącym preskalerze
+} display_stats_type;
+
+extern void display_get_stats(display_stats_type *stats);
+extern void display_reset_stats(void);
+#endif
+
+#ifdef DISPLAY_LEVEL_BITS
+//jasność pojedynczego segmentu 0 - (2^DISPLAY_LEVEL_BITS)-1, domyślnie maksymalna
+//numer segmentu 1-25 - bit pamięci ekranu + 1 wg mapy SEGMENT_MAP w display.c
+enum {
+	SEGMENT_PERCENT = 15,
+	SEGMENT_POWER,
+	SEGMENT_GREEN_2,
+	SEGMENT_GREEN_1,
+	SEGMENT_BLUE,
+	SEGMENT_RED,
+};
+extern void display_segment_level(uint8_t segment, uint8_t level);
+#endif
+
 
 #endif /* DISPLAY_H_ */
@@ -7,15 +7,20 @@
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/sleep.h>
 #include <util/delay.h>
 #include "software_timer.h"
-#include <stdlib.h>
 #include "display.h"
+#include "power.h"
 
 Timer counter_period;
-Timer power_period;
-Timer droplet_period;
-Timer filling_period;
+
+//bity powiadomień timerów
+#define COUNTER_EVENT _BV(0)
+volatile TimerMask Timer_pending;
+#ifdef TIMER_DELTA_QUEUE
+Timer * volatile Timer_queue;
+#endif
 //Timer error_showing;
 //Timer dash_showing;
 
@@ -25,47 +30,63 @@ Timer filling_period;
 #define DROPLET_DELAY_MS		100
 #define FILLING_DELAY_MS		500
 
-#define TICK_MS 8
+//animacje odtwarzane przez przerwanie wyświetlacza
+static const __flash display_key_type droplet_keys[] = {
+	{ DROP_N, DISPLAY_ANIM_MS(DROPLET_DELAY_MS) },
+	{ DROP_NE, DISPLAY_ANIM_MS(DROPLET_DELAY_MS) },
+	{ DROP_SE, DISPLAY_ANIM_MS(DROPLET_DELAY_MS) },
+	{ DROP_SW, DISPLAY_ANIM_MS(DROPLET_DELAY_MS) },
+	{ DROP_NW, DISPLAY_ANIM_MS(DROPLET_DELAY_MS) },
+};
+static const __flash display_anim_type droplet_anim = DISPLAY_ANIM(droplet_keys, 0);
+
+static const __flash display_key_type filling_keys[] = {
+	{ FILL_LEVEL_1, DISPLAY_ANIM_MS(FILLING_DELAY_MS) },
+	{ FILL_LEVEL_2, DISPLAY_ANIM_MS(FILLING_DELAY_MS) },
+	{ FILL_LEVEL_3, DISPLAY_ANIM_MS(FILLING_DELAY_MS) },
+	{ FILL_LEVEL_4, DISPLAY_ANIM_MS(FILLING_DELAY_MS) },
+	{ FILL_LEVEL_3, DISPLAY_ANIM_MS(FILLING_DELAY_MS) },
+	{ FILL_LEVEL_2, DISPLAY_ANIM_MS(FILLING_DELAY_MS) },
+};
+static const __flash display_anim_type filling_anim = DISPLAY_ANIM(filling_keys, 0);
 
 #define COUNTER_UP_TICKS 	TICKS(COUNTER_UP_DELAY_MS,TICK_MS)
 #define COUNTER_DOWN_TICKS	TICKS(COUNTER_DOWN_DELAY_MS,TICK_MS)
-#define POWER_TICKS			TICKS(POWER_DELAY_MS,TICK_MS)
-#define DROPLET_TICKS		TICKS(DROPLET_DELAY_MS,TICK_MS)
-#define FILLING_TICKS		TICKS(FILLING_DELAY_MS,TICK_MS)
 
 
 extern void do_counter(void);
-extern void do_power(void);
-extern void do_droplet(void);
-extern void do_filling(void);
 
 #pragma GCC diagnostic ignored "-Wmain"
 void main() {
 
+#ifndef DISPLAY_TICK_MS
 //timer 2 - licznik 5ms
 TIMSK2 = _BV(TOIE2);
 TCCR2B = _BV(CS22)|_BV(CS21); //preskaler 256 -> okres 8 ms -> TICK_MS
+#endif
 
 
 display_init();
 
 sei();
 //zapalenie całości
+display_begin();
 display_number(88);
 display_power(true);
 display_percent(true);
 display_droplet(5);
 display_filling(4);
+display_commit();
 
-//jasność
-for(uint8_t i=100; i>0; i--) {
-	_delay_ms(20);
-	display_brigthness(i-1);
+//jasność - zmiana w przerwaniu wyświetlacza, procesor śpi między przerwaniami
+set_sleep_mode(SLEEP_MODE_IDLE);
+display_fade_to(0, 2000);
+while(display_fading()) {
+	sleep_mode();
 }
-
-for(uint8_t i=0; i<100; i++) {
-	_delay_ms(20);
-	display_brigthness(i+1);
+display_fade_to(255, 2000);
+while(display_fading()) {
+	sleep_mode();
 }
 
 //test zatrzymania/wznowienia pracy drivera - DEEP SLEEP
@@ -148,34 +169,39 @@ _delay_ms(300);
 display_number_clear();
 
 
-Timer_setPeriod(&counter_period, TICKS(1000,TICK_MS));
-Timer_setPeriod(&power_period, TICKS(2000,TICK_MS));
-Timer_setPeriod(&droplet_period, TICKS(100,TICK_MS));
-Timer_setPeriod(&filling_period, TICKS(500,TICK_MS));
+Timer_setEvent(&counter_period, COUNTER_EVENT);
+//okresowy - przeładowanie w przerwaniu, bez dryfu od opóźnień pętli
+Timer_setPeriodic(&counter_period, TICKS(1000,TICK_MS), COUNTER_UP_TICKS);
+display_power(true);
+display_blink(DISPLAY_AREA_POWER, 2 * POWER_DELAY_MS, 50, 0);
+display_animate(DISPLAY_AREA_DROP, &droplet_anim);
+display_animate(DISPLAY_AREA_FILL, &filling_anim);
 
+//pętla budzona tylko przerwaniami, animacje nie wymagają jej udziału
 for(;;) {
-	if(Timer_isTime(&counter_period)) {
+	power_idle();
+	TimerMask events = Timer_takeEvents();
+	if(events & COUNTER_EVENT) {
 		do_counter();
 	}
-	if(Timer_isTime(&power_period)) {
-		do_power();
-	}
-	if(Timer_isTime(&droplet_period)) {
-		do_droplet();
-	}
-	if(Timer_isTime(&filling_period)) {
-		do_filling();
-	}
 }
 
 }
 
+#ifdef DISPLAY_TICK_MS
+void display_tick(void)
+#elif defined(DISPLAY_SCAN_PRIORITY)
+//przerwanie wyświetlacza wchodzi w trakcie - nie opóźnia startu slotu
+ISR(TIMER2_OVF_vect, ISR_NOBLOCK)
+#else
 ISR(TIMER2_OVF_vect)
+#endif
 {
+#ifdef TIMER_DELTA_QUEUE
+	Timer_tick();
+#else
 	Timer_count(&counter_period);
-	Timer_count(&power_period);
-	Timer_count(&droplet_period);
-	Timer_count(&filling_period);
+#endif
 }
 
 
@@ -183,8 +209,10 @@ void do_counter(void)
 {
 	static uint8_t counter;
 	static bool direction = true;
+	static Counter period = COUNTER_UP_TICKS;	//okres ustawiony w counter_period
 	Counter ticks = COUNTER_UP_TICKS;
 
+	display_begin();
 	display_number(counter);
 	if(direction) {
 		counter++;
@@ -206,38 +234,11 @@ void do_counter(void)
 	} else {
 		display_percent(false);
 	}
-	Timer_setPeriod(&counter_period, ticks);
-}
-
-void do_power(void)
-{
-	static bool show = true;
-	display_power(show);
-	show = !show;
-	Timer_setPeriod(&power_period, POWER_TICKS);
-}
-
-
-void do_droplet(void)
-{
-	static uint8_t segment;
-
-	segment %= DROP_SEGS_MAX;
-	display_droplet(segment++);
-	Timer_setPeriod(&droplet_period, DROPLET_TICKS);
-}
-
-void do_filling(void)
-{
-	static uint8_t level=1;
-
-	uint8_t dir = rand() & 1;
-	level += dir ? +1 : -1;
-	if(level == 0) {
-		level = 4;
-	} else if(level == 5) {
-		level = 1;
+	display_commit();
+	//zmiana kroku liczy się od tego zdarzenia jak w timerze jednorazowym,
+	//przeładowanie w przerwaniu wziąłby już poprzedni okres
+	if(ticks != period) {
+		period = ticks;
+		Timer_setPeriodic(&counter_period, ticks, ticks);
 	}
-	display_filling(level-1);
-	Timer_setPeriod(&filling_period, FILLING_TICKS);
 }
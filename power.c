@@ -0,0 +1,143 @@
+/*
+ * power.c
+ *
+ * Zarządzanie zasilaniem - idle albo sen bez ticka z budzeniem przez watchdog (power.h)
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+#include "software_timer.h"
+#include "power.h"
+
+#ifdef TIMER_DELTA_QUEUE
+
+//okresy watchdoga 16 ms * 2^i, bity WDP3..0
+__flash static uint8_t const wdt_prescalers[] = {
+		0,
+		_BV(WDP0),
+		_BV(WDP1),
+		_BV(WDP1) | _BV(WDP0),
+		_BV(WDP2),
+		_BV(WDP2) | _BV(WDP0),
+		_BV(WDP2) | _BV(WDP1),
+		_BV(WDP2) | _BV(WDP1) | _BV(WDP0),
+		_BV(WDP3),
+		_BV(WDP3) | _BV(WDP0),
+};
+#define WDT_MIN_MS 16
+#define WDT_STEPS (sizeof(wdt_prescalers) / sizeof(wdt_prescalers[0]))
+
+static volatile bool wdt_fired;
+
+ISR(WDT_vect)
+{
+	wdt_fired = true;
+}
+
+/*
+ * Nowa konfiguracja watchdoga, przy zablokowanych przerwaniach
+ * Sekwencja czasowa: WDCE i WDE, w ciągu 4 cykli nowa konfiguracja - oba zapisy w asemblerze
+ * jak w wdt_enable, kompilator nie wstawi między nie odczytu z tablicy ani ładowania stałej.
+ */
+static void wdt_config(uint8_t config)
+{
+	wdt_reset();
+	MCUSR &= ~_BV(WDRF);
+	asm volatile(
+		"sts %[wdtcsr], %[enable]"	"\n\t"
+		"sts %[wdtcsr], %[config]"	"\n\t"
+		:
+		: [wdtcsr] "n" (_SFR_MEM_ADDR(WDTCSR)),
+		  [enable] "r" ((uint8_t)(_BV(WDCE) | _BV(WDE))),
+		  [config] "r" (config)
+	);
+}
+
+static void wdt_start(uint8_t step)
+{
+	wdt_config(_BV(WDIE) | wdt_prescalers[step]);
+}
+
+static void wdt_stop(void)
+{
+	wdt_config(0);
+}
+
+/*
+ * Sen bez ticka, wywoływany przy zablokowanych przerwaniach
+ * Najdłuższy okres watchdoga nie dłuższy niż czas do terminu, po każdym doliczenie ticków.
+ * Bez aktywnych timerów sen kolejnymi okresami 8 s aż do innego przerwania.
+ * Zwraca false, gdy termin jest zbyt bliski dla watchdoga.
+ */
+static bool power_down(void)
+{
+	uint16_t rest_ms = 0;
+	Counter ticks = Timer_nextExpiry();
+
+	if(ticks && (uint32_t)ticks * TICK_MS < WDT_MIN_MS) {
+		return false;
+	}
+	//wyłączony przez aplikację zostaje wyłączony po przebudzeniu
+	bool driver = display_driver_running();
+	display_driver_off();
+	set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+	while(!Timer_pending) {
+		ticks = Timer_nextExpiry();
+		uint32_t left_ms = (uint32_t)ticks * TICK_MS - rest_ms;
+		uint8_t step = WDT_STEPS - 1;
+		if(ticks) {
+			if(left_ms < WDT_MIN_MS) {
+				//za krótko dla watchdoga - dokończenie w trybie idle
+				break;
+			}
+			while((uint32_t)WDT_MIN_MS << step > left_ms) {
+				step--;
+			}
+		}
+		wdt_fired = false;
+		wdt_start(step);
+		sleep_enable();
+		sei();
+		sleep_cpu();
+		sleep_disable();
+		cli();
+		wdt_stop();
+		if(!wdt_fired) {
+			break;
+		}
+		//doliczenie czasu snu, reszta poniżej ticka przechodzi na następny okres
+		rest_ms += WDT_MIN_MS << step;
+		while(rest_ms >= TICK_MS) {
+			rest_ms -= TICK_MS;
+			Timer_tick();
+		}
+	}
+	if(driver) {
+		display_driver_on();
+	}
+	return true;
+}
+#endif
+
+void power_idle(void)
+{
+	//sprawdzenie i uśpienie bez wyścigu z przerwaniem - sei wykonuje jeszcze sleep
+	cli();
+	if(Timer_pending) {
+		sei();
+		return;
+	}
+#ifdef TIMER_DELTA_QUEUE
+	if(display_idle() && power_down()) {
+		sei();
+		return;
+	}
+#endif
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	sleep_enable();
+	sei();
+	sleep_cpu();
+	sleep_disable();
+}
@@ -0,0 +1,40 @@
+/*
+ * power.h
+ *
+ * Zarządzanie zasilaniem - idle albo sen bez ticka z budzeniem przez watchdog
+ */
+
+#ifndef POWER_H_
+#define POWER_H_
+
+#include <stdbool.h>
+#include "display.h"
+
+/*
+ * Okres ticka timerów programowych
+ * Z przerwania wyświetlacza (DISPLAY_TICK_MS) albo z timera 2.
+ */
+#ifdef DISPLAY_TICK_MS
+#define TICK_MS DISPLAY_TICK_MS
+#else
+#define TICK_MS 8
+#endif
+
+/*
+ * Zarządzanie zasilaniem
+ * power_idle usypia mikrokontroler do najbliższego zdarzenia timerów programowych.
+ * Gdy wyświetlacz nic nie pokazuje (display_idle), timer wyświetlacza jest zatrzymywany,
+ * a procesor przechodzi w power-down z budzeniem przez watchdog w chwili najbliższego
+ * terminu timerów (tryb bez ticka). Po obudzeniu czas snu doliczany jest do timerów,
+ * a skanowanie wznawiane z bieżącą zawartością ekranu, o ile driver był włączony
+ * (display_driver_running). W przeciwnym razie tryb idle.
+ * Tryb bez ticka istnieje tylko z TIMER_DELTA_QUEUE (termin najbliższego timera),
+ * której domyślna konfiguracja nie włącza - wtedy power_idle używa tylko trybu idle.
+ * Ścieżka z watchdogiem nie ma testu - symulator nie modeluje snu ani watchdoga.
+ * Watchdog odmierza czas z dokładnością ok. 10%, przebudzenie innym przerwaniem kończy
+ * sen bez doliczenia niepełnego okresu watchdoga.
+ */
+//wywoływana z pętli głównej, wraca po zgłoszeniu zdarzenia timera lub innym przerwaniu
+extern void power_idle(void);
+
+#endif /* POWER_H_ */
@@ -0,0 +1,23 @@
+/*
+ * sim/avr/interrupt.h
+ *
+ * Symulacja na PC - procedury przerwań jako zwykłe funkcje o nazwie wektora, wywoływane
+ * przez symulator. sei/cli zmieniają bit I rejestru SREG.
+ */
+
+#ifndef SIM_AVR_INTERRUPT_H_
+#define SIM_AVR_INTERRUPT_H_
+
+#include <avr/io.h>
+
+#define ISR(vector, ...) void vector(void); void vector(void)
+#define ISR_NAKED
+#define ISR_NOBLOCK
+#define EMPTY_INTERRUPT(vector) void vector(void); void vector(void) {}
+
+#define sei() (SREG |= _BV(SREG_I))
+#define cli() (SREG &= (uint8_t)~_BV(SREG_I))
+//powrót z przerwania nagiego - symulator i tak przywraca SREG
+#define reti() sei()
+
+#endif /* SIM_AVR_INTERRUPT_H_ */
@@ -0,0 +1,80 @@
+/*
+ * sim/avr/io.h
+ *
+ * Symulacja na PC - rejestry ATmega328 jako zmienne, definiowane przez symulator (sim.c).
+ * Zapis do rejestrów flag przerwań (TIFR0) czyści flagi jak w sprzęcie - obsługuje symulator.
+ * Zapis do rejestru PIN nie przełącza pinów portu, DISPLAY_ISR_ASM i DISPLAY_BLANK_TOGGLE
+ * nie są obsługiwane.
+ */
+
+#ifndef SIM_AVR_IO_H_
+#define SIM_AVR_IO_H_
+
+#include <stdint.h>
+
+#define _BV(bit) (1 << (bit))
+//pamięć programu - zwykła pamięć
+#define __flash
+
+#define SIM_REG(name) extern volatile uint8_t name;
+
+SIM_REG(PORTD) SIM_REG(DDRD) SIM_REG(PIND)
+SIM_REG(TCCR0A) SIM_REG(TCCR0B) SIM_REG(TCNT0) SIM_REG(OCR0A) SIM_REG(OCR0B)
+SIM_REG(TIMSK0) SIM_REG(TIFR0)
+SIM_REG(TCCR2A) SIM_REG(TCCR2B) SIM_REG(TCNT2) SIM_REG(OCR2A) SIM_REG(OCR2B)
+SIM_REG(TIMSK2) SIM_REG(TIFR2) SIM_REG(ASSR)
+SIM_REG(GPIOR0) SIM_REG(GPIOR1) SIM_REG(GPIOR2)
+SIM_REG(WDTCSR) SIM_REG(MCUSR) SIM_REG(SMCR)
+SIM_REG(SREG)
+
+//TCCR0A
+#define WGM00	0
+#define WGM01	1
+//TCCR0B
+#define CS00	0
+#define CS01	1
+#define CS02	2
+#define WGM02	3
+//TIMSK0, TIFR0
+#define TOIE0	0
+#define OCIE0A	1
+#define OCIE0B	2
+#define TOV0	0
+#define OCF0A	1
+#define OCF0B	2
+//TCCR2A, TCCR2B
+#define WGM20	0
+#define WGM21	1
+#define CS20	0
+#define CS21	1
+#define CS22	2
+#define WGM22	3
+//TIMSK2, TIFR2
+#define TOIE2	0
+#define OCIE2A	1
+#define OCIE2B	2
+#define TOV2	0
+#define OCF2A	1
+#define OCF2B	2
+//ASSR
+#define TCR2BUB	0
+#define TCR2AUB	1
+#define OCR2BUB	2
+#define OCR2AUB	3
+#define TCN2UB	4
+#define AS2		5
+//WDTCSR
+#define WDP0	0
+#define WDP1	1
+#define WDP2	2
+#define WDE		3
+#define WDCE	4
+#define WDP3	5
+#define WDIE	6
+#define WDIF	7
+//MCUSR
+#define WDRF	3
+//SREG
+#define SREG_I	7
+
+#endif /* SIM_AVR_IO_H_ */
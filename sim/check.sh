@@ -0,0 +1,48 @@
+#!/bin/sh
+#
+# check.sh
+#
+# Test regresji symulatora
+# Każdy skrypt sim/tests/*.txt wykonywany jest przez symulator zbudowany z opcjami z wiersza
+# "# flags:" i uruchomiony z argumentami z wiersza "# args:", wynik porównywany jest
+# z wzorcem sim/tests/*.out. -u zapisuje bieżące wyniki jako nowe wzorce.
+#
+# sim/check.sh [-u] [test ...]
+
+cd "$(dirname "$0")/.." || exit 1
+
+update=false
+if [ "$1" = "-u" ]; then
+	update=true
+	shift
+fi
+if [ $# -eq 0 ]; then
+	set -- sim/tests/*.txt
+fi
+
+#opcje z nawiasami i ? (wagi DWELL_*) bez rozwijania nazw plików
+set -f
+exe=$(mktemp) || exit 1
+trap 'rm -f "$exe"' EXIT
+failed=0
+
+for test in "$@"; do
+	test=sim/tests/$(basename "$test" .txt)
+	flags=$(sed -n 's/^# flags://p' "$test.txt")
+	args=$(sed -n 's/^# args://p' "$test.txt")
+	if ! gcc -std=gnu11 -Wall -Werror -Isim -DF_CPU=8000000UL $flags sim/sim.c -lm -o "$exe"; then
+		echo "BUILD $test"
+		failed=1
+		continue
+	fi
+	if $update; then
+		"$exe" $args < "$test.txt" > "$test.out"
+		echo "UPDATE $test"
+	elif "$exe" $args < "$test.txt" | diff -u "$test.out" -; then
+		echo "OK $test"
+	else
+		echo "FAIL $test"
+		failed=1
+	fi
+done
+exit $failed
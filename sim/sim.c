@@ -0,0 +1,468 @@
+/*
+ * sim.c
+ *
+ * Symulacja drivera wyświetlacza na PC
+ * display.c kompilowany jest natywnie z rejestrami z sim/avr/io.h. Symulator krokuje timer0
+ * (tryb 7, OCR0A/OCR0B buforowane do BOTTOM, TOV0 na TOP), wywołuje procedury przerwań
+ * TIMER0_COMPB_vect i TIMER0_OVF_vect zgodnie z priorytetem, a po każdej zmianie pinów
+ * dekoduje z kierunku i stanu linii, które segmenty SEG_n rzeczywiście świecą (anoda HIGH,
+ * katoda LOW). Czas wykonania przerwań nie jest symulowany - przerwanie startuje w takcie
+ * zgłoszenia flagi (przepełnienie w takcie TOP, przed BOTTOM) i jego zapisy obowiązują od razu.
+ * -d CYKLE przesuwa je o tyle cykli zegara (pełne takty timera) - np. -d 64 przy preskalerze
+ * 64 odpowiada zapisom po BOTTOM. Wynik drivera nie powinien zależeć od -d poza czasem
+ * świecenia przesuniętym o opóźnienie.
+ *
+ * gcc -std=gnu11 -Wall -Isim -DF_CPU=8000000UL [-DDISPLAY_...] sim/sim.c -lm -o display_sim
+ * ./display_sim [-v] [-p] [-t] [-d CYKLE] < skrypt
+ *
+ * Wyjście - wiersz na ramkę (od przerwania ze slotem 0 do następnego):
+ *   F <nr> t=<cykl początku> len=<cykle> lit=<maska SEG_n, bit n-1> on=<min>..<max>
+ * on - najkrótszy i najdłuższy czas świecenia zapalonych segmentów w cyklach zegara,
+ * -v dodaje czasy wszystkich zapalonych segmentów, -p każdą zmianę stanu linii:
+ *   P t=<cykl> A=<H|L|Z> ...
+ * -t każdy tick timerów programowych (z wyświetlacza przy DISPLAY_TICK_MS):
+ *   K t=<cykl>
+ * Wyjście jest deterministyczne - porównanie z zapisanym (diff) sprawdza zmiany silnika
+ * skanowania względem wzorcowych ramek. sim/check.sh wykonuje skrypty .txt z katalogu
+ * sim/tests (opcje budowy i argumenty w ich nagłówkach) i porównuje wyniki ze wzorcami .out.
+ *
+ * Polecenia skryptu (wiersz na polecenie, # - komentarz):
+ *   number N, number_clear, clear, power 0|1, percent 0|1, droplet N, filling N,
+ *   brightness N, luminance N, fade N MS, refresh HZ, animate AREA, blink AREA MS DUTY PHASE,
+ *   level SEG L (DISPLAY_LEVEL_BITS), count MS - licznik na wyświetlaczu co MS (0 - stop),
+ *   driver 0|1 - display_driver_off/display_driver_on,
+ *   timer N MS PERIOD - timer programowy N (1-3) jednorazowy po MS albo okresowy co PERIOD
+ *   (MS 0 - zatrzymanie), zdarzenia wypisywane jako E t=<cykl> timer=<N>,
+ *   run MS - symulacja przez MS milisekund, stats - liczniki DISPLAY_STATS (czasy przerwań
+ *   zerowe, bo nie są symulowane):
+ *   S frames=<n> slots=<n> late=<n> overruns=<n> dropped=<n> renders=<n> calls=<n>,...
+ *     hist=<n>,...
+ */
+
+//takt timera w czasie oczekiwania przerwania na BOTTOM
+static void timer0_tick(void);
+#define TIMER_WAIT_BOTTOM(top) while(TCNT0 == (top)) timer0_tick()
+
+#include "../display.c"
+#include "../software_timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(DISPLAY_ISR_ASM) || defined(DISPLAY_BLANK_TOGGLE)
+#error "symulacja wymaga przerwań w C, bez DISPLAY_ISR_ASM i DISPLAY_BLANK_TOGGLE"
+#endif
+
+volatile uint8_t PORTD, DDRD, PIND;
+volatile uint8_t TCCR0A, TCCR0B, TCNT0, OCR0A, OCR0B, TIMSK0, TIFR0;
+volatile uint8_t TCCR2A, TCCR2B, TCNT2, OCR2A, OCR2B, TIMSK2, TIFR2, ASSR;
+volatile uint8_t GPIOR0, GPIOR1, GPIOR2;
+volatile uint8_t WDTCSR, MCUSR, SMCR;
+volatile uint8_t SREG;
+
+volatile TimerMask Timer_pending;
+#ifdef TIMER_DELTA_QUEUE
+Timer * volatile Timer_queue;
+#endif
+
+//tick timerów programowych - z wyświetlacza albo osobnego timera jak w main.c
+#ifdef DISPLAY_TICK_MS
+#define SIM_TICK_MS DISPLAY_TICK_MS
+#else
+#define SIM_TICK_MS 8
+#endif
+#define SIM_TICK_CYCLES ((uint64_t)(F_CPU / 1000) * SIM_TICK_MS)
+#define COUNTER_EVENT _BV(0)
+#define SIM_TIMERS 3
+
+static bool verbose;
+static bool pins_trace;
+static bool tick_trace;
+static uint16_t isr_delay;		//cykle od zgłoszenia przerwania do jego zapisów (-d)
+
+/*
+ * Stan symulacji
+ */
+static uint64_t sim_cycles;		//czas w cyklach zegara
+static uint8_t tifr0;			//flagi przerwań timera0
+static uint8_t ocra = TIMER_MAX;	//bufory OCR0A/OCR0B obowiązujące w bieżącym okresie
+static uint8_t ocrb = TIMER_MAX;
+#ifndef DISPLAY_TICK_MS
+static uint64_t next_tick = SIM_TICK_CYCLES;	//tick timerów programowych
+#endif
+
+//ramka
+static uint32_t frame_no;
+static bool frame_open;
+static uint64_t frame_start;
+static uint32_t seg_on[SEG_MAX];	//czas świecenia segmentów w bieżącej ramce
+
+//piny
+static uint8_t last_dir, last_port;
+static screen_type lit;			//segmenty świecące przy bieżącym stanie linii
+
+static Timer counter_timer;
+static uint8_t counter;
+static Timer sim_timers[SIM_TIMERS];	//polecenie timer, zdarzenia _BV(1)...
+
+typedef struct {
+	const char *name;
+	uint8_t mask;
+} sim_line_type;
+
+#define SIM_LINE(p, line) { #line, LINE_MASK(line) },
+static const sim_line_type sim_lines[] = {
+		DISPLAY_LINES(SIM_LINE, 0)
+};
+
+static const uint16_t prescalers[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+
+//segmenty zapalone przy danym kierunku i stanie linii
+static screen_type lit_decode(uint8_t dir, uint8_t port)
+{
+	screen_type bits = 0;
+	for(uint8_t i = 0; i < SEG_MAX; i++) {
+		segment_type seg = segments[i];
+		if((dir & seg.active_mask) == seg.active_mask && (port & seg.active_mask) == seg.anode_mask) {
+			bits |= (screen_type)1 << i;
+		}
+	}
+	return bits;
+}
+
+static void pins_update(void)
+{
+	uint8_t dir = O_DIR & DISPLAY_LINES_MASK;
+	uint8_t port = O_PORT & DISPLAY_LINES_MASK;
+	if(dir == last_dir && port == last_port) {
+		return;
+	}
+	last_dir = dir;
+	last_port = port;
+	lit = lit_decode(dir, port);
+	if(pins_trace) {
+		printf("P t=%llu", (unsigned long long)sim_cycles);
+		for(uint8_t l = 0; l < ARRAY_SIZE(sim_lines); l++) {
+			uint8_t m = sim_lines[l].mask;
+			printf(" %s=%c", sim_lines[l].name, !(dir & m) ? 'Z' : (port & m) ? 'H' : 'L');
+		}
+		printf("\n");
+	}
+}
+
+static void frame_close(void)
+{
+	if(!frame_open) {
+		return;
+	}
+	screen_type mask = 0;
+	uint32_t on_min = UINT32_MAX, on_max = 0;
+	for(uint8_t i = 0; i < SEG_MAX; i++) {
+		if(seg_on[i]) {
+			mask |= (screen_type)1 << i;
+			if(seg_on[i] < on_min) {
+				on_min = seg_on[i];
+			}
+			if(seg_on[i] > on_max) {
+				on_max = seg_on[i];
+			}
+		}
+	}
+	if(!mask) {
+		on_min = 0;
+	}
+	printf("F %u t=%llu len=%llu lit=%0*llx on=%u..%u", frame_no,
+			(unsigned long long)frame_start, (unsigned long long)(sim_cycles - frame_start),
+			(SEG_MAX + 3) / 4, (unsigned long long)mask, on_min, on_max);
+	if(verbose) {
+		for(uint8_t i = 0; i < SEG_MAX; i++) {
+			if(seg_on[i]) {
+				printf(" %u:%u", i + 1, seg_on[i]);
+			}
+		}
+	}
+	printf("\n");
+	memset(seg_on, 0, sizeof(seg_on));
+	frame_open = false;
+}
+
+//wywołanie procedury przerwania z wyłączonymi przerwaniami, jak w sprzęcie
+static void sim_interrupt(void (*isr)(void))
+{
+	uint16_t div = prescalers[TCCR0B & 7];
+	uint8_t sreg = SREG;
+	cli();
+	//opóźnienie zapisów - timer liczy dalej przy starym stanie linii
+	for(uint32_t c = div; div && c <= isr_delay; c += div) {
+		timer0_tick();
+	}
+	isr();
+	SREG = sreg;
+	pins_update();
+}
+
+static void overflow_interrupt(void)
+{
+	//przerwanie wyświetla slot 0 - początek ramki
+	if(!scan_counter) {
+		frame_close();
+		frame_no++;
+		frame_open = true;
+		frame_start = sim_cycles;
+	}
+	sim_interrupt(TIMER0_OVF_vect);
+}
+
+//przerwania w kolejności priorytetów (numerów wektorów)
+static void interrupts_service(void)
+{
+	//zapis jedynek do TIFR0 czyści flagi
+	tifr0 &= ~TIFR0;
+	TIFR0 = 0;
+	if(!(SREG & _BV(SREG_I))) {
+		return;
+	}
+	if((tifr0 & _BV(OCF0B)) && (TIMSK0 & _BV(OCIE0B))) {
+		tifr0 &= ~_BV(OCF0B);
+		sim_interrupt(TIMER0_COMPB_vect);
+	}
+	if((tifr0 & _BV(TOV0)) && (TIMSK0 & _BV(TOIE0))) {
+		tifr0 &= ~_BV(TOV0);
+		overflow_interrupt();
+	}
+}
+
+//krok licznika timera0 w trybie 7
+static void timer0_step(void)
+{
+	if(TCNT0 == ocra) {
+		TCNT0 = 0;
+		ocra = OCR0A;
+		ocrb = OCR0B;
+	} else {
+		TCNT0++;
+	}
+	if(TCNT0 == ocrb) {
+		tifr0 |= _BV(OCF0B);
+	}
+	if(TCNT0 == ocra) {
+		tifr0 |= _BV(TOV0);
+	}
+}
+
+//tick timerów programowych i pętla główna licznika jak w main.c
+static void timers_tick(void)
+{
+	if(tick_trace) {
+		printf("K t=%llu\n", (unsigned long long)sim_cycles);
+	}
+#ifdef TIMER_DELTA_QUEUE
+	Timer_tick();
+#else
+	Timer_count(&counter_timer);
+	for(uint8_t i = 0; i < SIM_TIMERS; i++) {
+		Timer_count(&sim_timers[i]);
+	}
+#endif
+}
+
+#ifdef DISPLAY_TICK_MS
+void display_tick(void)
+{
+	timers_tick();
+}
+#endif
+
+static void main_loop(void)
+{
+	TimerMask events = Timer_takeEvents();
+	if(events & COUNTER_EVENT) {
+		display_number(counter++ % 100);
+	}
+	for(uint8_t i = 0; i < SIM_TIMERS; i++) {
+		if(events & _BV(i + 1)) {
+			printf("E t=%llu timer=%u\n", (unsigned long long)sim_cycles, i + 1);
+		}
+	}
+}
+
+//takt timera0 z czasem świecenia segmentów
+static void timer0_tick(void)
+{
+	uint16_t div = prescalers[TCCR0B & 7];
+	pins_update();
+	sim_cycles += div;
+	timer0_step();
+	for(uint8_t i = 0; i < SEG_MAX; i++) {
+		if(lit & ((screen_type)1 << i)) {
+			seg_on[i] += div;
+		}
+	}
+}
+
+static void sim_run(uint32_t ms)
+{
+	uint64_t end = sim_cycles + (uint64_t)ms * (F_CPU / 1000);
+	bool was_running = false;
+
+	while(sim_cycles < end) {
+		uint16_t div = prescalers[TCCR0B & 7];
+		interrupts_service();
+		pins_update();
+		if(div) {
+			was_running = true;
+			timer0_tick();
+		} else {
+			//timer stoi - ostatnia ramka zakończona, czas do następnego zdarzenia
+			if(was_running) {
+				frame_close();
+				was_running = false;
+			}
+			uint64_t next = end;
+#ifndef DISPLAY_TICK_MS
+			if(next_tick < next) {
+				next = next_tick;
+			}
+#endif
+			sim_cycles = (next > sim_cycles) ? next : sim_cycles + 1;
+		}
+#ifndef DISPLAY_TICK_MS
+		if(sim_cycles >= next_tick) {
+			next_tick += SIM_TICK_CYCLES;
+			uint8_t sreg = SREG;
+			cli();
+			timers_tick();
+			SREG = sreg;
+		}
+#endif
+		main_loop();
+	}
+}
+
+//klatki animacji dla polecenia animate - mignięcie obszaru
+static const __flash display_key_type sim_flash_keys[] = {
+		{0, DISPLAY_ANIM_MS(100)},
+		{99, DISPLAY_ANIM_MS(100)},
+};
+static const __flash display_anim_type sim_flash = DISPLAY_ANIM(sim_flash_keys, 3);
+
+static void command(char *line)
+{
+	char cmd[32];
+	long a = 0, b = 0, c = 0, d = 0;
+	int n = sscanf(line, "%31s %ld %ld %ld %ld", cmd, &a, &b, &c, &d);
+
+	if(n < 1 || cmd[0] == '#') {
+		return;
+	}
+	if(!strcmp(cmd, "number")) {
+		display_number(a);
+	} else if(!strcmp(cmd, "number_clear")) {
+		display_number_clear();
+	} else if(!strcmp(cmd, "clear")) {
+		display_clear();
+	} else if(!strcmp(cmd, "power")) {
+		display_power(a);
+	} else if(!strcmp(cmd, "percent")) {
+		display_percent(a);
+	} else if(!strcmp(cmd, "droplet")) {
+		display_droplet(a);
+	} else if(!strcmp(cmd, "filling")) {
+		display_filling(a);
+	} else if(!strcmp(cmd, "brightness")) {
+		display_brigthness(a);
+	} else if(!strcmp(cmd, "luminance")) {
+		display_luminance(a);
+	} else if(!strcmp(cmd, "fade")) {
+		display_fade_to(a, b);
+	} else if(!strcmp(cmd, "refresh")) {
+		display_set_refresh(a);
+	} else if(!strcmp(cmd, "animate")) {
+		display_animate(a, &sim_flash);
+	} else if(!strcmp(cmd, "blink")) {
+		display_blink(a, b, c, d);
+#ifdef DISPLAY_LEVEL_BITS
+	} else if(!strcmp(cmd, "level")) {
+		display_segment_level(a, b);
+#endif
+	} else if(!strcmp(cmd, "count")) {
+		if(a) {
+			Counter ticks = TICKS(a, SIM_TICK_MS);
+			Timer_setPeriodic(&counter_timer, ticks, ticks);
+		} else {
+			Timer_setPeriod(&counter_timer, 0);
+		}
+	} else if(!strcmp(cmd, "timer") && a >= 1 && a <= SIM_TIMERS) {
+		Timer *t = &sim_timers[a - 1];
+		if(b && c) {
+			Timer_setPeriodic(t, TICKS(b, SIM_TICK_MS), TICKS(c, SIM_TICK_MS));
+		} else {
+			Timer_setPeriod(t, b ? TICKS(b, SIM_TICK_MS) : 0);
+		}
+	} else if(!strcmp(cmd, "driver")) {
+		if(a) {
+			//skanowanie wznawiane od bieżącego slotu - niepełna ramka
+			if(!frame_open) {
+				frame_no++;
+				frame_open = true;
+				frame_start = sim_cycles;
+			}
+			display_driver_on();
+		} else {
+			display_driver_off();
+			frame_close();
+		}
+	} else if(!strcmp(cmd, "run")) {
+		sim_run(a);
+#ifdef DISPLAY_STATS
+	} else if(!strcmp(cmd, "stats")) {
+		display_stats_type st;
+		display_get_stats(&st);
+		printf("S frames=%lu slots=%lu late=%lu overruns=%u dropped=%u renders=%u calls=",
+				(unsigned long)st.frames, (unsigned long)st.slots, (unsigned long)st.late,
+				st.overruns, st.dropped, st.renders);
+		for(uint8_t area = 0; area < DISPLAY_AREA_MAX; area++) {
+			printf(area ? ",%u" : "%u", st.calls[area]);
+		}
+		printf(" hist=");
+		for(uint8_t bin = 0; bin < DISPLAY_STATS_BINS; bin++) {
+			printf(bin ? ",%u" : "%u", st.latency_hist[bin]);
+		}
+		printf("\n");
+#endif
+	} else {
+		fprintf(stderr, "nieznane polecenie: %s\n", cmd);
+		exit(1);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	char line[256];
+
+	for(int i = 1; i < argc; i++) {
+		if(!strcmp(argv[i], "-v")) {
+			verbose = true;
+		} else if(!strcmp(argv[i], "-p")) {
+			pins_trace = true;
+		} else if(!strcmp(argv[i], "-t")) {
+			tick_trace = true;
+		} else if(!strcmp(argv[i], "-d") && i + 1 < argc) {
+			isr_delay = atoi(argv[++i]);
+		} else {
+			fprintf(stderr, "użycie: %s [-v] [-p] [-t] [-d CYKLE] < skrypt\n", argv[0]);
+			return 1;
+		}
+	}
+	Timer_setEvent(&counter_timer, COUNTER_EVENT);
+	for(uint8_t i = 0; i < SIM_TIMERS; i++) {
+		Timer_setEvent(&sim_timers[i], _BV(i + 1));
+	}
+	display_init();
+	sei();
+	while(fgets(line, sizeof(line), stdin)) {
+		command(line);
+	}
+	frame_close();
+	return 0;
+}
@@ -0,0 +1,33 @@
+/*
+ * sim/util/atomic.h
+ *
+ * Symulacja na PC - ATOMIC_BLOCK jak w avr-libc, na bicie I rejestru SREG
+ */
+
+#ifndef SIM_UTIL_ATOMIC_H_
+#define SIM_UTIL_ATOMIC_H_
+
+#include <avr/interrupt.h>
+
+static inline uint8_t sim_cli(void)
+{
+	cli();
+	return 1;
+}
+
+static inline void sim_restore(const uint8_t *sreg)
+{
+	SREG = *sreg;
+}
+
+static inline void sim_force_on(const uint8_t *sreg)
+{
+	(void)sreg;
+	sei();
+}
+
+#define ATOMIC_BLOCK(type) for(type, sim_done = sim_cli(); sim_done; sim_done = 0)
+#define ATOMIC_RESTORESTATE uint8_t sim_sreg __attribute__((cleanup(sim_restore))) = SREG
+#define ATOMIC_FORCEON uint8_t sim_sreg __attribute__((cleanup(sim_force_on))) = 0
+
+#endif /* SIM_UTIL_ATOMIC_H_ */
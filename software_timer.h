@@ -18,9 +18,92 @@
  */
 typedef struct Timer {
 	_Bool active;
-	volatile Counter cnt;
+	volatile Counter cnt;		//!< ticks left, in delta queue ticks after predecessor
+	TimerMask event;
+	Counter period;				//!< reload value of periodic timer, 0 for one-shot
+	volatile uint8_t expired;	//!< periodic expiry not taken yet by Timer_isTime
+	volatile uint8_t overruns;	//!< periodic expiries missed by background loop
+#ifdef TIMER_DELTA_QUEUE
+	struct Timer *next;
+	volatile _Bool queued;
+#endif
 } Timer;
 
+/*! \var   Timer_pending
+ *  \brief Expiry notifications
+ *
+ *  Bits of timers which expired since last Timer_takeEvents. Has to be defined
+ *  once by application.
+ */
+extern volatile TimerMask Timer_pending;
+
+#ifdef TIMER_DELTA_QUEUE
+/*! \var   Timer_queue
+ *  \brief Head of delta queue
+ *
+ *  Timers sorted by expiry, head counter is never 0. Has to be defined once by
+ *  application.
+ *
+ *  Tick interrupt cost grows with the number of timers when Timer_count is
+ *  called for each of them and stays constant with Timer_tick, except for ticks
+ *  at which timers expire. Cycle counts for 4, 16 and 64 timers are reported by
+ *  bench/bench.c (timer_count.N, timer_tick.N, timer_tick_expire.N).
+ *
+ *  Timer_setPeriod walks queued timers expiring before the new one, with
+ *  interrupts disabled. Periodic timer pays the same at its expiry tick.
+ */
+extern Timer * volatile Timer_queue;
+
+/*! \fn    Queue removal
+ *  \brief Removes timer from delta queue, giving its ticks to successor
+ *
+ *  To be called within QUEUE_SECTION.
+ *
+ * @param me pointer to software timer instance
+ */
+static inline void Timer_unlink(Timer * const me)
+{
+	if(!me->queued) {
+		return;
+	}
+	Timer * volatile *link = &Timer_queue;
+	while(*link != me) {
+		link = &(*link)->next;
+	}
+	*link = me->next;
+	if(me->next) {
+		me->next->cnt += me->cnt;
+	}
+	me->queued = 0;
+}
+
+/*! \fn    Queue insertion
+ *  \brief Inserts timer into delta queue
+ *
+ *  To be called within QUEUE_SECTION. Timer expiring at the same tick as
+ *  queued ones goes after them with delta 0.
+ *
+ * @param me    pointer to software timer instance
+ * @param ticks number of ticks to go, not 0
+ */
+static inline void Timer_link(Timer * const me, Counter ticks)
+{
+	Timer * volatile *link = &Timer_queue;
+	Timer *t;
+	while((t = *link) && t->cnt <= ticks) {
+		ticks -= t->cnt;
+		link = &t->next;
+	}
+	me->cnt = ticks;
+	me->next = t;
+	if(t) {
+		t->cnt -= ticks;
+	}
+	*link = me;
+	me->queued = 1;
+}
+#endif
+
 /*! \def   Ticks
  *  \brief Ticks calculator
  *
@@ -43,9 +126,50 @@ typedef struct Timer {
 static inline void Timer_ctor(Timer * const me)
 {
 	me->active = 0;
+#ifdef TIMER_DELTA_QUEUE
+	QUEUE_SECTION_BEGIN
+	Timer_unlink(me);
+	QUEUE_SECTION_END
+	me->next = 0;
+#endif
 	CRITICAL_SECTION_BEGIN
 	me->cnt = 0;
+	me->period = 0;
 	CRITICAL_SECTION_END
+	me->expired = 0;
+	me->overruns = 0;
+}
+
+/*! \fn    Notification setter
+ *  \brief Sets expiry notification bit
+ *
+ *  On expiry Timer_count sets given bit in Timer_pending, so background loop
+ *  may sleep until any timer fires instead of polling all of them. Zero
+ *  (default for instance in BSS section) disables notification.
+ *
+ * @param me    pointer to software timer instance
+ * @param event notification bit, unique among timers
+ */
+static inline void Timer_setEvent(Timer * const me, TimerMask event)
+{
+	me->event = event;
+}
+
+/*! \fn    Events taker
+ *  \brief Takes and clears expiry notifications
+ *
+ *  Function is to be called from background loop.
+ *
+ * @return bits of timers expired since previous call
+ */
+static inline TimerMask Timer_takeEvents(void)
+{
+	TimerMask events;
+	EVENT_SECTION_BEGIN
+	events = Timer_pending;
+	Timer_pending = 0;
+	EVENT_SECTION_END
+	return events;
 }
 
 /*! \fn    Setter
@@ -56,12 +180,92 @@ static inline void Timer_ctor(Timer * const me)
  */
 static inline void Timer_setPeriod(Timer * const me, Counter ticks)
 {
-	CRITICAL_SECTION_BEGIN
+#ifdef TIMER_DELTA_QUEUE
+	QUEUE_SECTION_BEGIN
+	me->period = 0;
+	Timer_unlink(me);
+	if(ticks) {
+		Timer_link(me, ticks);
+	} else {
+		me->cnt = 0;
+	}
+	QUEUE_SECTION_END
+#else
+	EVENT_SECTION_BEGIN
+	me->period = 0;
 	me->cnt = ticks;
-	CRITICAL_SECTION_END
+	EVENT_SECTION_END
+#endif
 	me->active = 1;
 }
 
+/*! \fn    Periodic setter
+ *  \brief Starts periodic timer
+ *
+ *  Timer is reloaded by Timer_count (Timer_tick) at expiry, so period does
+ *  not depend on background latency. Every expiry is taken once by
+ *  Timer_isTime, expiries not taken before next one are counted as overruns.
+ *  Timer_setPeriod makes timer one-shot again.
+ *
+ * @param me     pointer to software timer instance
+ * @param ticks  number of ticks to first expiry, 0 - one period
+ * @param period number of ticks between next expiries, not 0
+ */
+static inline void Timer_setPeriodic(Timer * const me, Counter ticks, Counter period)
+{
+	if(!ticks) {
+		ticks = period;
+	}
+#ifdef TIMER_DELTA_QUEUE
+	QUEUE_SECTION_BEGIN
+	me->period = period;
+	me->expired = 0;
+	me->overruns = 0;
+	Timer_unlink(me);
+	Timer_link(me, ticks);
+	QUEUE_SECTION_END
+#else
+	EVENT_SECTION_BEGIN
+	me->period = period;
+	me->expired = 0;
+	me->overruns = 0;
+	me->cnt = ticks;
+	EVENT_SECTION_END
+#endif
+	me->active = 1;
+}
+
+/*! \fn    Reload setter
+ *  \brief Changes period of running periodic timer
+ *
+ *  New period applies from next expiry, without restarting current one.
+ *
+ * @param me     pointer to software timer instance
+ * @param period number of ticks between expiries, not 0
+ */
+static inline void Timer_setReload(Timer * const me, Counter period)
+{
+	CRITICAL_SECTION_BEGIN
+	me->period = period;
+	CRITICAL_SECTION_END
+}
+
+/*! \fn    Overrun taker
+ *  \brief Takes and clears number of missed periodic expiries
+ *
+ * @param  me pointer to software timer instance
+ * @return expiries not taken by Timer_isTime before next one, saturated at 255
+ */
+static inline uint8_t Timer_takeOverruns(Timer * const me)
+{
+	uint8_t overruns;
+	EVENT_SECTION_BEGIN
+	overruns = me->overruns;
+	me->overruns = 0;
+	EVENT_SECTION_END
+	return overruns;
+}
+
 /*! \fn    Activator
  *  \brief Activates/decactivates software timer
  *
@@ -80,22 +284,54 @@ static inline void Timer_activate(Timer * const me, _Bool activeness)
  *  \brief checks if timer expired
  *
  *  Function is to be called from background loop.
- *  First call after expiry deactivates software timer
+ *  First call after expiry deactivates one-shot software timer, periodic one
+ *  keeps running and reports each expiry once.
  *
  * @param  me pointer to software timer instance
  * @return 1 if timer expired and active, 0 otherwise
  */
 static inline _Bool Timer_isTime(Timer * const me)
 {
-	Counter cnt;
 	_Bool result;
+	if(me->period) {
+		//periodic timer never stops, expiries are flagged by interrupt
+		EVENT_SECTION_BEGIN
+		result = me->expired && me->active;
+		if(result) {
+			me->expired = 0;
+		}
+		EVENT_SECTION_END
+		return result;
+	}
+#ifdef TIMER_DELTA_QUEUE
+	result = !me->queued && me->active && !(me->active=0);
+#else
+	Counter cnt;
 	CRITICAL_SECTION_BEGIN
 	cnt = me->cnt;
 	CRITICAL_SECTION_END
 	result = !cnt && me->active && !(me->active=0);
+#endif
 	return result;
 }
 
+/*! \fn    Expiry
+ *  \brief Notifies expiry, called from within timer interrupt
+ *
+ * @param me pointer to software timer instance
+ */
+static inline void Timer_expire(Timer * const me) __attribute__((always_inline));
+static inline void Timer_expire(Timer * const me)
+{
+	Timer_pending |= me->event;
+	if(me->period) {
+		if(me->expired && me->overruns != 0xff) {
+			me->overruns++;
+		}
+		me->expired = 1;
+	}
+}
+
 /*! \fn Counter
  *  \brief Counts time
  *
@@ -109,7 +345,62 @@ static inline void Timer_count(Timer * const me)
 	Counter tmp = me->cnt;
 	if(tmp) {
 		me->cnt=--tmp;
+		if(!tmp) {
+			Timer_expire(me);
+#ifndef TIMER_DELTA_QUEUE
+			if(me->period) {
+				me->cnt = me->period;
+			}
+#endif
+		}
+	}
+}
+
+#ifdef TIMER_DELTA_QUEUE
+/*! \fn    Next expiry
+ *  \brief Ticks to nearest expiry, for tickless sleep
+ *
+ *  To be called with interrupts disabled.
+ *
+ * @return ticks to nearest expiry, 0 if no timer is running
+ */
+static inline Counter Timer_nextExpiry(void)
+{
+	Timer *head = Timer_queue;
+	return head ? head->cnt : 0;
+}
+
+/*! \fn Tick
+ *  \brief Counts time of all queued timers
+ *
+ *  Function should be called from within timer interrupt, instead of
+ *  Timer_count for every instance.
+ */
+static inline void Timer_tick(void)
+{
+	Timer *head = Timer_queue;
+	if(!head || --head->cnt) {
+		return;
+	}
+	//detach all timers expiring at this tick
+	Timer *expired = head, *last;
+	do {
+		last = head;
+		head = head->next;
+	} while(head && !head->cnt);
+	Timer_queue = head;
+	last->next = 0;
+	//periodic ones go back, full period from this tick
+	while(expired) {
+		Timer *t = expired;
+		expired = t->next;
+		t->queued = 0;
+		Timer_expire(t);
+		if(t->period) {
+			Timer_link(t, t->period);
+		}
 	}
 }
+#endif
 
 #endif /* SOFTWARE_TIMER_H_ */
@@ -9,22 +9,76 @@
 #define SOFTWARE_TIMER_PORT_H_
 
 #include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+/*! \def
+ *  \brief Interrupt guard for notification mask
+ *
+ *  Taking events is read-modify-write shared with timer interrupt, so it has
+ *  to be guarded regardless of mask width.
+ */
+#define EVENT_SECTION_BEGIN { uint8_t sreg_save = SREG; cli();
+#define EVENT_SECTION_END SREG = sreg_save; }
+
+/*! \def
+ *  \brief Width of timer counter: 8, 16 or 32 bits
+ *
+ *  8 bits give 255 ticks, about 2 s at 8 ms tick.
+ */
+#ifndef TIMER_COUNTER_BITS
+#define TIMER_COUNTER_BITS 8
+#endif
 
 /*! \typedef
  *  \brief Type of timer counter
  *
- * Look out capacity of counter. In this case it is 256 ticks. Overflowing is not
- * checked.
+ * Look out capacity of counter. Overflowing is not checked.
  */
-typedef uint8_t Counter;
-
 /*! \def
  *  \brief Interrupt guard
  *
- *  In case of uint8_t there is no need to guard critical sections.
+ *  In case of uint8_t there is no need to guard critical sections, wider
+ *  counters are accessed by several instructions.
  */
+#if TIMER_COUNTER_BITS == 8
+typedef uint8_t Counter;
 #define CRITICAL_SECTION_BEGIN
 #define CRITICAL_SECTION_END
+#elif TIMER_COUNTER_BITS == 16
+typedef uint16_t Counter;
+#define CRITICAL_SECTION_BEGIN EVENT_SECTION_BEGIN
+#define CRITICAL_SECTION_END EVENT_SECTION_END
+#elif TIMER_COUNTER_BITS == 32
+typedef uint32_t Counter;
+#define CRITICAL_SECTION_BEGIN EVENT_SECTION_BEGIN
+#define CRITICAL_SECTION_END EVENT_SECTION_END
+#else
+#error "TIMER_COUNTER_BITS must be 8, 16 or 32"
+#endif
+
+/*! \typedef
+ *  \brief Type of expiry notification mask
+ *
+ *  One bit per notifying timer, so 8 timers can notify in this case.
+ */
+typedef uint8_t TimerMask;
+
+/*! \def
+ *  \brief Delta queue instead of per instance counting
+ *
+ *  Timers waiting for expiry are kept in list sorted by expiry time, each
+ *  holding ticks left after its predecessor. Tick interrupt calls Timer_tick
+ *  once and touches the head only, instead of calling Timer_count for every
+ *  instance. Timer_setPeriod walks the list with interrupts disabled.
+ */
+//#define TIMER_DELTA_QUEUE
+
+/*! \def
+ *  \brief Interrupt guard for delta queue
+ */
+#define QUEUE_SECTION_BEGIN EVENT_SECTION_BEGIN
+#define QUEUE_SECTION_END EVENT_SECTION_END
 
 
 #endif /* SOFTWARE_TIMER_PORT_H_ */